@@ -107,6 +107,12 @@ static void clock_10ms(void) {
 
 	temp_tick();
 
+  #ifdef COALESCE_MOVES
+    // Don't let the queue run dry while a move waits for more to merge.
+    if (queue_waiting() < 2)
+      enqueue_flush();
+  #endif
+
 	ifclock(clock_flag_250ms) {
 		clock_250ms();
 	}
@@ -117,6 +123,9 @@ static void clock_10ms(void) {
 	call it occasionally in busy loops
 */
 void clock() {
+  // Heater and temperature changes from the movement queue.
+  queue_actions();
+
 	ifclock(clock_flag_10ms) {
 		clock_10ms();
 	}
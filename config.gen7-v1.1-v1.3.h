@@ -160,6 +160,15 @@
 */
 // #define E_ABSOLUTE
 
+/** \def EXTRUDERS
+	Number of extruders, 1 to 3. T selects the one G-code E moves, T0 is the first one. The others need E1_STEP_PIN and E1_DIR_PIN, or E2_STEP_PIN and E2_DIR_PIN, in the pinouts section below.
+
+	STEPS_PER_M_E1, MAXIMUM_FEEDRATE_E1, ACCELERATION_E1 and MAX_JERK_E1 default to those of E. E1_OFFSET_X and E1_OFFSET_Y are the position of its nozzle relative to the first one, in mm, 0 by default. Likewise for E2. PRESSURE_ADVANCE applies to the first extruder only.
+*/
+// #define EXTRUDERS 2
+// #define E1_OFFSET_X 20.0
+// #define E1_OFFSET_Y 0.0
+
 
 
 /***************************************************************************\
@@ -196,6 +205,27 @@
 */
 #define ACCELERATION 1000.
 
+/** \def ACCELERATION_X ACCELERATION_Y ACCELERATION_Z ACCELERATION_E
+	per-axis acceleration limits when using ACCELERATION_RAMPING, in mm/s^2.
+		Axes not defined here use ACCELERATION. Each move accelerates as fast as all axes involved allow, so e.g. a slow Z axis doesn't slow down XY moves.
+*/
+// #define ACCELERATION_X 1000.
+// #define ACCELERATION_Y 1000.
+// #define ACCELERATION_Z 100.
+// #define ACCELERATION_E 1000.
+
+/** \def RAMP_LOOKUP_TABLE
+	use a lookup table with interpolation for calculating acceleration ramps instead of an inverse square root search when using ACCELERATION_RAMPING.
+		This is faster and more accurate, at the cost of about 100 bytes of flash.
+*/
+// #define RAMP_LOOKUP_TABLE
+
+/** \def ACCELERATION_SCURVE
+	jerk limited acceleration when using ACCELERATION_RAMPING.
+		Acceleration rises smoothly from zero at the start of each ramp and falls back to zero at its end instead of switching on and off, which excites less ringing of the frame. Jerk is constant and ACCELERATION stays the peak acceleration, so ramps get twice as long. Speeds at the ends of the ramps, and such between joined moves with LOOKAHEAD, are the same as without.
+*/
+// #define ACCELERATION_SCURVE
+
 /** \def ACCELERATION_TEMPORAL
 	temporal step algorithm
 		This algorithm causes the timer to fire when any axis needs to step, instead of synchronising to the axis with the most steps ala bresenham.
@@ -248,6 +278,32 @@
 #define MAX_JERK_Z 0
 #define MAX_JERK_E 20
 
+/** \def JUNCTION_DEVIATION
+  Define this to let look-ahead find the speed at movement crossings from the
+  angle between both moves instead of the speed bumps on each axis. The
+  crossing gets rounded off by a circle passing this far from the crossing
+  point, and the speed is the one where taking this circle needs no more than
+  the acceleration of the moves. Shallow angles pass almost at full speed, on
+  diagonal moves just as well as on axis aligned ones. It also takes less
+  time to calculate than the MAX_JERK approach, which helps with lots of
+  short moves. MAX_JERK_X, MAX_JERK_Y and MAX_JERK_Z are unused then,
+  MAX_JERK_E still limits changes of the extrusion rate.
+
+  Units: mm
+  Sane values: 0.005 to 0.05
+*/
+// #define JUNCTION_DEVIATION 0.02
+
+/** \def ARC_SUPPORT
+  Define this to get G2 and G3, arcs in the XY plane, as native moves. Each
+  arc takes a single movement queue entry and is split into chords in
+  dda_clock(), instead of the host sending lots of short G1 moves. Chords
+  deviate no more than ARC_TOLERANCE (default 5 um) from the ideal arc.
+  Works with ACCELERATION_RAMPING only. Costs 22 bytes of RAM per movement
+  queue entry and about 110 bytes more for the step segment queue.
+*/
+// #define ARC_SUPPORT
+
 
 
 /***************************************************************************\
@@ -312,6 +368,12 @@
 //#define	E_INVERT_DIR
 //#define	E_INVERT_ENABLE
 
+//#define	E1_STEP_PIN						xxxx
+//#define	E1_DIR_PIN						xxxx
+//#define	E1_ENABLE_PIN					xxxx
+//#define	E1_INVERT_DIR
+//#define	E1_INVERT_ENABLE
+
 #define	PS_ON_PIN							DIO15
 //#define PS_MOSFET_PIN         xxxx
 #define STEPPER_ENABLE_PIN		DIO24
@@ -533,11 +595,29 @@ PWM value for 'off'
 
 /**
 	move buffer size, in number of moves
-		note that each move takes a fair chunk of ram (69 bytes as of this writing) so don't make the buffer too big - a bigger serial readbuffer may help more than increasing this unless your gcodes are more than 70 characters long on average.
+		note that each move takes a fair chunk of ram (55 bytes without acceleration, 108 bytes with ACCELERATION_RAMPING and LOOKAHEAD as of this writing) so don't make the buffer too big - a bigger serial readbuffer may help more than increasing this unless your gcodes are more than 70 characters long on average.
 		however, a larger movebuffer will probably help with lots of short consecutive moves, as each move takes a bunch of math (hence time) to set up so a longer buffer allows more of the math to be done during preceding longer moves
 */
 #define	MOVEBUFFER_SIZE	8
 
+/** \def QUEUE_STATISTICS
+	statistics of the movement queue, reported with M225.
+		Counts how many moves are queued on each clock tick while moving, how often the queue runs dry while G-code keeps coming in and, with LOOKAHEAD, the speeds at which moves get joined. Tells whether the host, the planner or the CPU limits printing speed. Takes 4 bytes of RAM per move of MOVEBUFFER_SIZE.
+*/
+// #define QUEUE_STATISTICS
+
+/** \def SLOWDOWN
+	slow down short moves while the movement queue runs low. Value is the shortest time a move should take, in milliseconds.
+		Moves faster than this get slowed down while less than half of MOVEBUFFER_SIZE moves are queued, the emptier the queue, the more. This leaves reading and planning G-code time to catch up, instead of the queue running dry and the printer stopping between moves, which leaves blobs on the print. 20 is a good start when printing from a host. Endstop searches keep their speed.
+*/
+// #define SLOWDOWN 20
+
+/** \def COALESCE_MOVES
+	merge G1 moves going on in the same direction into one queued move. Value is how far points dropped this way may be off the merged move, in micrometers.
+		Slicers cut curves into many short moves, often shorter than planning them takes. Merged, they use fewer MOVEBUFFER_SIZE entries and less planning time, so look-ahead sees a longer stretch of the print. Only moves at the same feedrate and extrusion rate merge. The last move is held back while at least two moves are queued, as the next one might go on in the same direction. 10 is a good start.
+*/
+// #define COALESCE_MOVES 10
+
 /** \def DC_EXTRUDER
 	DC extruder
 		If you have a DC motor extruder, configure it as a "heater" above and define this value as the index or name. You probably also want to comment out E_STEP_PIN and E_DIR_PIN in the Pinouts section above.
@@ -563,6 +643,19 @@ PWM value for 'off'
 */
 #define		STEP_INTERRUPT_INTERRUPTIBLE	1
 
+/** \def STEP_BATCH_RATE
+	step rate of the fast axis, in steps/second, above which one step interrupt does more than one step. Works with ACCELERATION_RAMPING only.
+		Above this rate 2 steps are done per interrupt, above twice this rate 4 steps and above four times this rate 8 steps. Steps of one interrupt are sent back to back, so step timing gets a bit uneven, but much less CPU time is spent in the step interrupt. Useful for high step rates, e.g. with 1/16 or 1/32 microstepping.
+		Leave this undefined to always do one step per interrupt.
+*/
+// #define STEP_BATCH_RATE 20000
+
+/** \def PRESSURE_ADVANCE
+	extruder pressure advance, when using ACCELERATION_RAMPING. Value is the factor K, in seconds.
+		Pressure in the nozzle lags behind the extruder, so too little comes out when accelerating and too much when decelerating. With this, the extruder gets advanced by K times its speed, so it moves ahead while accelerating and falls back while decelerating. Typical values are 0.02 to 0.1 for direct drive extruders and up to 1. for Bowden extruders. K can be changed with M233, 0. compiles the feature in, but leaves it off until set. Moves of the extruder alone and arcs don't get advance.
+*/
+// #define PRESSURE_ADVANCE 0.05
+
 /**
 	temperature history count. This is how many temperature readings to keep in order to calculate derivative in PID loop
 	higher values make PID derivative term more stable at the expense of reaction time
@@ -591,6 +684,12 @@ PWM value for 'off'
 */
 #define	ENDSTOP_STEPS	4
 
+/** \def ENDSTOP_INTERRUPT
+	endstop detection by pin change interrupts instead of polling them every 2 milliseconds. Value is the debounce time, in microseconds.
+		Homing moves start to decelerate right after an endstop triggered instead of after ENDSTOP_STEPS polls, so they overshoot less and can approach faster. An endstop has to stay triggered for the debounce time. Endstop pins without a pin change interrupt (see the datasheet of your chip) are still polled. Valid range is 0...1000.
+*/
+// #define ENDSTOP_INTERRUPT 20
+
 /** \def CANNED_CYCLE
 
   G-code commands in this string will be executed over and over again, without
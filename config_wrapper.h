@@ -9,8 +9,23 @@
 #define USER_CONFIG "config.h"
 #endif
 
+#ifdef SIMULATOR
+  // Configured endstops become simulator pins after each inclusion of
+  // config.h, see simulator.h. Don't redefine them with the chip pins.
+  #undef X_MIN_PIN
+  #undef X_MAX_PIN
+  #undef Y_MIN_PIN
+  #undef Y_MAX_PIN
+  #undef Z_MIN_PIN
+  #undef Z_MAX_PIN
+#endif
+
 #include USER_CONFIG
 
+#ifdef SIMULATOR
+  #include "simulator.h"
+#endif
+
 /**
   Give users a hint in case they obviously forgot to read instructions.
 */
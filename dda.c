@@ -16,6 +16,7 @@
 #include "dda_kinematics.h"
 #include	"dda_lookahead.h"
 #include	"timer.h"
+#include "delay.h"
 #include	"serial.h"
 #include	"sermsg.h"
 #include	"gcode_parse.h"
@@ -43,6 +44,39 @@ TARGET BSS startpoint;
 /// \brief target position of last move in queue, expressed in steps
 TARGET BSS startpoint_steps;
 
+/// \var substep_start
+/// \brief where moves smaller than a single step began, see dda_create()
+static TARGET BSS substep_start;
+
+/// \var substep_pending
+/// \brief bool: moves since substep_start were too small to get queued
+static uint8_t substep_pending = 0;
+
+/// \var e_relative
+/// \brief sum of relative E distances since the last G92, in um and steps
+static struct {
+  int32_t um;
+  int32_t steps;
+} e_relative;
+
+#ifdef PRESSURE_ADVANCE
+/// \var advance_k
+/// \brief pressure advance factor K, in milliseconds, see M233
+uint16_t advance_k = (uint16_t)(PRESSURE_ADVANCE * 1000.);
+#endif
+
+/// \var feed_override
+/// \brief feed override, in percent of the requested feedrate, see M220
+uint16_t feed_override = 100;
+
+/// \var flow_override
+/// \brief flow override, in percent of the requested E distance, see M221
+uint16_t flow_override = 100;
+
+/// \var flow_remainder
+/// \brief rounding remainder of dda_flow_steps(), for each extruder
+static int8_t flow_remainder[AXIS_COUNT - E];
+
 /// \var current_position
 /// \brief actual position of extruder head
 /// \todo make current_position = real_position (from endstops) + offset from G28 and friends
@@ -52,14 +86,17 @@ TARGET BSS current_position;
 /// \brief numbers for tracking the current state of movement
 MOVE_STATE BSS move_state;
 
-/// \var steps_per_m_P
-/// \brief motor steps required to advance one meter on each axis
-static const axes_uint32_t PROGMEM steps_per_m_P = {
-  STEPS_PER_M_X,
-  STEPS_PER_M_Y,
-  STEPS_PER_M_Z,
-  STEPS_PER_M_E
-};
+#ifdef ACCELERATION_RAMPING
+/// \var ramp_state
+/// \brief the two RAMP_STATEs move_state.ramp points to in turn
+static RAMP_STATE BSS ramp_state[2];
+
+/// Move following the current one with its first segments queued already,
+/// NULL if none, see dda_prepare(). They start at move_state.seg_tail ==
+/// prepared_tail.
+static DDA *prepared = NULL;
+static uint8_t prepared_tail;
+#endif
 
 /// \var maximum_feedrate_P
 /// \brief maximum allowed feedrate on each axis
@@ -67,18 +104,47 @@ static const axes_uint32_t PROGMEM maximum_feedrate_P = {
   MAXIMUM_FEEDRATE_X,
   MAXIMUM_FEEDRATE_Y,
   MAXIMUM_FEEDRATE_Z,
-  MAXIMUM_FEEDRATE_E
+  MAXIMUM_FEEDRATE_E,
+  #if EXTRUDERS > 1
+  MAXIMUM_FEEDRATE_E1,
+  #endif
+  #if EXTRUDERS > 2
+  MAXIMUM_FEEDRATE_E2,
+  #endif
 };
 
+#ifdef ACCELERATION_RAMPING
 /// \var c0_P
 /// \brief Initialization constant for the ramping algorithm. Timer cycles for
-///        first step interval.
+///        first step interval at the full acceleration of each axis.
 static const axes_uint32_t PROGMEM c0_P = {
-  (uint32_t)((double)F_CPU / SQRT((double)(STEPS_PER_M_X * ACCELERATION / 2000.))),
-  (uint32_t)((double)F_CPU / SQRT((double)(STEPS_PER_M_Y * ACCELERATION / 2000.))),
-  (uint32_t)((double)F_CPU / SQRT((double)(STEPS_PER_M_Z * ACCELERATION / 2000.))),
-  (uint32_t)((double)F_CPU / SQRT((double)(STEPS_PER_M_E * ACCELERATION / 2000.)))
+  (uint32_t)((double)F_CPU / SQRT((double)(STEPS_PER_M_X * ACCELERATION_X / 2000.))),
+  (uint32_t)((double)F_CPU / SQRT((double)(STEPS_PER_M_Y * ACCELERATION_Y / 2000.))),
+  (uint32_t)((double)F_CPU / SQRT((double)(STEPS_PER_M_Z * ACCELERATION_Z / 2000.))),
+  (uint32_t)((double)F_CPU / SQRT((double)(STEPS_PER_M_E * ACCELERATION_E / 2000.))),
+  #if EXTRUDERS > 1
+  (uint32_t)((double)F_CPU / SQRT((double)(STEPS_PER_M_E1 * ACCELERATION_E1 / 2000.))),
+  #endif
+  #if EXTRUDERS > 2
+  (uint32_t)((double)F_CPU / SQRT((double)(STEPS_PER_M_E2 * ACCELERATION_E2 / 2000.))),
+  #endif
+};
+
+/// \var acceleration_P
+/// \brief maximum allowed acceleration on each axis, in mm/s^2 * 16
+const axes_uint32_t PROGMEM acceleration_P = {
+  (uint32_t)(ACCELERATION_X * 16.),
+  (uint32_t)(ACCELERATION_Y * 16.),
+  (uint32_t)(ACCELERATION_Z * 16.),
+  (uint32_t)(ACCELERATION_E * 16.),
+  #if EXTRUDERS > 1
+  (uint32_t)(ACCELERATION_E1 * 16.),
+  #endif
+  #if EXTRUDERS > 2
+  (uint32_t)(ACCELERATION_E2 * 16.),
+  #endif
 };
+#endif
 
 /*! Set the direction of the 'n' axis
 */
@@ -93,6 +159,14 @@ static void set_direction(DDA *dda, enum axis_e n, int32_t delta) {
     dda->z_direction = dir;
   else if (n == E)
     dda->e_direction = dir;
+  #if EXTRUDERS > 1
+  else if (n == E1)
+    dda->e1_direction = dir;
+  #endif
+  #if EXTRUDERS > 2
+  else if (n == E2)
+    dda->e2_direction = dir;
+  #endif
 }
 
 /*! Find the direction of the 'n' axis
@@ -101,18 +175,356 @@ static int8_t get_direction(DDA *dda, enum axis_e n) {
   if ((n == X && dda->x_direction) ||
       (n == Y && dda->y_direction) ||
       (n == Z && dda->z_direction) ||
-      (n == E && dda->e_direction))
+      (n == E && dda->e_direction)
+      #if EXTRUDERS > 1
+      || (n == E1 && dda->e1_direction)
+      #endif
+      #if EXTRUDERS > 2
+      || (n == E2 && dda->e2_direction)
+      #endif
+     )
     return 1;
   else
     return -1;
 }
 
+/*! Add the steps done by a move to a motor position.
+  \param *dda the move, running or just done
+  \param pos position in steps, e.g. move_state.position
+
+  Steps done are those of dda->delta no longer left in move_state.steps.
+  Arcs know their X and Y position already, see RAMP_STATE.arc_steps. E isn't
+  counted, relative E and the flow override make E steps a poor measure of
+  G-code E.
+
+  Called with interrupts off, at the end of each move and for reporting the
+  position, see update_current_position().
+*/
+static void dda_position_add(DDA *dda, axes_int32_t pos) {
+  int32_t done;
+
+  #ifdef ARC_SUPPORT
+    if (dda->arc) {
+      pos[X] = move_state.ramp->arc_steps[X];
+      pos[Y] = move_state.ramp->arc_steps[Y];
+      pos[Z] += dda->z_direction ? move_state.ramp->arc_steps[Z] :
+                                   -move_state.ramp->arc_steps[Z];
+      return;
+    }
+  #endif
+
+  done = dda->delta[X] - move_state.steps[X];
+  pos[X] += dda->x_direction ? done : -done;
+  done = dda->delta[Y] - move_state.steps[Y];
+  pos[Y] += dda->y_direction ? done : -done;
+  done = dda->delta[Z] - move_state.steps[Z];
+  pos[Z] += dda->z_direction ? done : -done;
+}
+
+/*! Scale E steps by the flow override.
+  \param steps E steps of a move, as requested
+  \param e the extruder axis moving
+  \return E steps to do
+
+  The remainder of the division carries over to the next move of the same
+  extruder, so the sum of all moves has no rounding error and absolute E
+  doesn't drift. Splitting steps avoids overflow of the multiplication.
+*/
+static int32_t dda_flow_steps(int32_t steps, enum axis_e e) {
+  int8_t *remainder = &flow_remainder[e - E];
+  int32_t scaled;
+
+  scaled = (steps % 100) * flow_override + *remainder;
+  *remainder = scaled % 100;
+
+  return (steps / 100) * flow_override + scaled / 100;
+}
+
+/*! Find the endstops in the stop condition of a move.
+  \param *dda the move
+  \param check endstops to look at, same bits as dda->endstop_check
+  \return endstops in stop condition, same bits
+*/
+static uint8_t dda_endstops(DDA *dda, uint8_t check) {
+  uint8_t hit = 0;
+
+  #ifdef X_MIN_PIN
+  if ((check & 0x01) && x_min() == dda->endstop_stop_cond)
+    hit |= 0x01;
+  #endif
+  #ifdef X_MAX_PIN
+  if ((check & 0x02) && x_max() == dda->endstop_stop_cond)
+    hit |= 0x02;
+  #endif
+  #ifdef Y_MIN_PIN
+  if ((check & 0x04) && y_min() == dda->endstop_stop_cond)
+    hit |= 0x04;
+  #endif
+  #ifdef Y_MAX_PIN
+  if ((check & 0x08) && y_max() == dda->endstop_stop_cond)
+    hit |= 0x08;
+  #endif
+  #ifdef Z_MIN_PIN
+  if ((check & 0x10) && z_min() == dda->endstop_stop_cond)
+    hit |= 0x10;
+  #endif
+  #ifdef Z_MAX_PIN
+  if ((check & 0x20) && z_max() == dda->endstop_stop_cond)
+    hit |= 0x20;
+  #endif
+
+  return hit;
+}
+
+/*! Stop the current move due to an endstop trigger.
+  \param *dda the current move
+
+  With ACCELERATION_RAMPING, the move decelerates to a stop instead of
+  halting abruptly. Called from dda_clock(), and with ENDSTOP_INTERRUPT from
+  dda_start(), dda_step() and the pin change interrupt, too. Whatever comes
+  first stops the move, later calls do nothing.
+*/
+static void dda_endstop_stop(DDA *dda) {
+  ATOMIC_START
+    if ( ! move_state.endstop_stop) {
+      #ifdef ACCELERATION_RAMPING
+        RAMP_STATE *ramp = move_state.ramp;
+
+        // Drop queued segments, dda_clock() re-plans from here.
+        while (ramp->seg_head != move_state.seg_tail) {
+          ramp->seg_head = (ramp->seg_head - 1) &
+                           (STEP_SEGMENT_BUFFER_SIZE - 1);
+          ramp->step_no -= move_state.segments[ramp->seg_head].steps;
+          #ifdef PRESSURE_ADVANCE
+            if (dda->advance) {
+              SEGMENT *drop = &move_state.segments[ramp->seg_head];
+
+              ramp->e_queued -= drop->e_direction ?
+                (int32_t)drop->e_steps : -(int32_t)drop->e_steps;
+            }
+          #endif
+        }
+        if (ramp->step_no < dda->rampup_steps) { // still accelerating
+          #ifdef ACCELERATION_SCURVE
+            // Speed on S-curves isn't proportional to the steps done, so
+            // decelerate from the speed of the segment executing, or of
+            // the first step. Its ramp position is n = (c0 / (2 * c))^2,
+            // see dda_ramp_c().
+            SEGMENT *seg = &move_state.segments[(move_state.seg_tail - 1) &
+                                              (STEP_SEGMENT_BUFFER_SIZE - 1)];
+            uint32_t n = 0;
+
+            if (ramp->step_no) {
+              if (ramp->step_no > 1)
+                n = muldiv(dda->c0, 16 * seg->batch, seg->c);
+              else
+                n = muldiv(dda->c0, 16, dda->c);
+              n = muldiv(n, n, 1024);
+              #ifdef LOOKAHEAD
+                n = (n > dda->end_steps) ? n - dda->end_steps : 0;
+              #endif
+            }
+            dda->total_steps = ramp->step_no + n;
+          #else
+            // Decelerate from the ramp position reached, see
+            // fill_segments().
+            uint32_t n = ramp->step_no - ramp->ramp_step;
+
+            n = ramp->ramp_slow ? ramp->ramp_base - n : ramp->ramp_base + n;
+            #ifdef LOOKAHEAD
+              n = (n > dda->end_steps) ? n - dda->end_steps : 0;
+            #endif
+            dda->total_steps = ramp->step_no + n;
+          #endif
+        }
+        else
+          // A "-=" would overflow earlier.
+          dda->total_steps = dda->total_steps - dda->rampdown_steps +
+                             ramp->step_no;
+        dda->rampdown_steps = ramp->step_no;
+        #ifdef ACCELERATION_SCURVE
+          ramp->ramp_phase = 0;
+        #endif
+        dda->rampup_steps = 0; // in case we're still accelerating
+        ramp->ramp_slow = 0;
+      #else
+        dda_position_add(dda, move_state.position);
+        dda->live = 0;
+      #endif
+      move_state.endstop_stop = 1;
+      #ifdef ENDSTOP_INTERRUPT
+        move_state.endstop_edge = 0;
+      #endif
+      endstops_off();
+    }
+  ATOMIC_END
+}
+
+#ifdef ENDSTOP_INTERRUPT
+/// Endstops with a pin change interrupt, same bits as dda->endstop_check.
+/// Others are polled in dda_clock(), see dda_init().
+static uint8_t endstop_pcint;
+
+#ifndef SIMULATOR
+/*! Enable the pin change interrupt of a pin.
+  \param port input register of the pin, e.g. PINA
+  \param pin bit of the pin in this register
+  \return whether this pin has a pin change interrupt
+
+  Pin change interrupts come in groups of up to eight pins, usually one port
+  each. Which ports have them differs between chips, see their datasheets.
+*/
+static uint8_t pcint_enable(volatile uint8_t *port, uint8_t pin) {
+  #if defined (__AVR_ATmega1280__) || defined (__AVR_ATmega2560__)
+    if (port == &PINB) {
+      PCMSK0 |= MASK(pin);
+      PCICR |= MASK(PCIE0);
+      return 1;
+    }
+    if ((port == &PINE && pin == 0) || (port == &PINJ && pin < 7)) {
+      PCMSK1 |= (port == &PINE) ? MASK(0) : MASK(pin + 1);
+      PCICR |= MASK(PCIE1);
+      return 1;
+    }
+    if (port == &PINK) {
+      PCMSK2 |= MASK(pin);
+      PCICR |= MASK(PCIE2);
+      return 1;
+    }
+  #elif defined PCMSK3 // ATmega644, ATmega1284 and friends.
+    if (port == &PINA) {
+      PCMSK0 |= MASK(pin);
+      PCICR |= MASK(PCIE0);
+      return 1;
+    }
+    if (port == &PINB) {
+      PCMSK1 |= MASK(pin);
+      PCICR |= MASK(PCIE1);
+      return 1;
+    }
+    if (port == &PINC) {
+      PCMSK2 |= MASK(pin);
+      PCICR |= MASK(PCIE2);
+      return 1;
+    }
+    if (port == &PIND) {
+      PCMSK3 |= MASK(pin);
+      PCICR |= MASK(PCIE3);
+      return 1;
+    }
+  #elif defined PCMSK2 // ATmega168, ATmega328.
+    if (port == &PINB) {
+      PCMSK0 |= MASK(pin);
+      PCICR |= MASK(PCIE0);
+      return 1;
+    }
+    if (port == &PINC) {
+      PCMSK1 |= MASK(pin);
+      PCICR |= MASK(PCIE1);
+      return 1;
+    }
+    if (port == &PIND) {
+      PCMSK2 |= MASK(pin);
+      PCICR |= MASK(PCIE2);
+      return 1;
+    }
+  #elif defined PCMSK0 // ATmega32U4, AT90USB128x: port B only.
+    if (port == &PINB) {
+      PCMSK0 |= MASK(pin);
+      PCICR |= MASK(PCIE0);
+      return 1;
+    }
+  #endif
+  return 0;
+}
+
+#define _PCINT_ENABLE(IO) pcint_enable(&IO ## _RPORT, IO ## _PIN)
+#define PCINT_ENABLE(IO)  _PCINT_ENABLE(IO)
+#else
+#define PCINT_ENABLE(IO)  sim_pcint_enable(IO)
+#endif /* SIMULATOR */
+
+/*! Check the endstops of a move after a pin change.
+  \param *dda the current move
+
+  An endstop reaching the stop condition of the move starts the debounce
+  time, an endstop leaving it again cancels it. The time stamp is taken from
+  timer 1, which runs at F_CPU, so the debounce time doesn't depend on how
+  quickly this gets checked again, see dda_step() and dda_clock().
+*/
+static void dda_endstop_edge(DDA *dda) {
+  uint8_t hit;
+
+  if (move_state.endstop_stop)
+    return;
+
+  hit = dda_endstops(dda, move_state.endstop_check & endstop_pcint);
+  if ( ! hit)
+    move_state.endstop_edge = 0;
+  else if ( ! move_state.endstop_edge) {
+    move_state.endstop_edge_time = TCNT1;
+    move_state.endstop_edge = 1;
+    #if ENDSTOP_INTERRUPT == 0
+      dda_endstop_stop(dda);
+    #endif
+  }
+}
+
+/// Pin change interrupt of all endstops with one, see dda_init().
+ISR(PCINT0_vect) {
+  DDA *dda = queue_current_movement();
+
+  if (dda)
+    dda_endstop_edge(dda);
+}
+#if defined PCINT1_vect && ! defined SIMULATOR
+  ISR(PCINT1_vect, ISR_ALIASOF(PCINT0_vect));
+#endif
+#if defined PCINT2_vect && ! defined SIMULATOR
+  ISR(PCINT2_vect, ISR_ALIASOF(PCINT0_vect));
+#endif
+#if defined PCINT3_vect && ! defined SIMULATOR
+  ISR(PCINT3_vect, ISR_ALIASOF(PCINT0_vect));
+#endif
+#endif /* ENDSTOP_INTERRUPT */
+
 /*! Inititalise DDA movement structures
 */
 void dda_init(void) {
 	// set up default feedrate
 	if (startpoint.F == 0)
 		startpoint.F = next_target.target.F = SEARCH_FEEDRATE_Z;
+
+  #ifdef ACCELERATION_RAMPING
+    move_state.ramp = &ramp_state[0];
+  #endif
+
+  #ifdef ENDSTOP_INTERRUPT
+    #ifdef X_MIN_PIN
+      if (PCINT_ENABLE(X_MIN_PIN))
+        endstop_pcint |= 0x01;
+    #endif
+    #ifdef X_MAX_PIN
+      if (PCINT_ENABLE(X_MAX_PIN))
+        endstop_pcint |= 0x02;
+    #endif
+    #ifdef Y_MIN_PIN
+      if (PCINT_ENABLE(Y_MIN_PIN))
+        endstop_pcint |= 0x04;
+    #endif
+    #ifdef Y_MAX_PIN
+      if (PCINT_ENABLE(Y_MAX_PIN))
+        endstop_pcint |= 0x08;
+    #endif
+    #ifdef Z_MIN_PIN
+      if (PCINT_ENABLE(Z_MIN_PIN))
+        endstop_pcint |= 0x10;
+    #endif
+    #ifdef Z_MAX_PIN
+      if (PCINT_ENABLE(Z_MAX_PIN))
+        endstop_pcint |= 0x20;
+    #endif
+  #endif
 }
 
 /*! Distribute a new startpoint to DDA's internal structures without any movement.
@@ -122,9 +534,224 @@ void dda_init(void) {
 void dda_new_startpoint(void) {
   enum axis_e i;
 
+  // All extruders count from the same E, see TARGET.
   for (i = X; i < AXIS_COUNT; i++)
-    startpoint_steps.axis[i] = um_to_steps(startpoint.axis[i], i);
+    startpoint_steps.axis[i] = um_to_steps(startpoint.axis[i < E ? i : E], i);
+
+  // Distances carried over belong to the old origin.
+  substep_pending = 0;
+  e_relative.um = e_relative.steps = 0;
+  memset(flow_remainder, 0, sizeof(flow_remainder));
+
+  // The step position counters follow once the queued moves are done.
+  if (queue_empty()) {
+    ATOMIC_START
+      memcpy(move_state.position, startpoint_steps.axis,
+             sizeof(axes_int32_t));
+    ATOMIC_END
+  }
+  else
+    enqueue_position();
+}
+
+#ifdef ACCELERATION_RAMPING
+/*! Find the acceleration of a move from the per-axis limits.
+  \param *dda the move, with fast_axis and fast_um already set
+  \param delta_um distance moved by each axis, in um
+
+  All axes accelerate in proportion to their share of the movement, so each
+  axis sees the acceleration of the fast axis, scaled by delta_um[i] /
+  fast_um. The axis hitting its limit first limits the whole move. The result
+  goes to dda->accel_scale, relative to the limit of the fast axis, and
+  dda->c0 accordingly.
+*/
+static void dda_find_acceleration(DDA *dda, axes_uint32_t delta_um) {
+  enum axis_e i;
+  uint32_t fast_acc, d, scale = 4096;
+
+  fast_acc = pgm_read_dword(&acceleration_P[dda->fast_axis]);
+  for (i = X; i < AXIS_COUNT; i++) {
+    if (i == dda->fast_axis || delta_um[i] == 0)
+      continue;
+    // Movement of this axis, scaled as if it had the fast axis' limit.
+    d = muldiv(delta_um[i], fast_acc, pgm_read_dword(&acceleration_P[i]));
+    if (d > dda->fast_um) {
+      d = muldiv(dda->fast_um, 4096, d);
+      if (d < scale)
+        scale = d;
+    }
+  }
+  #ifdef ACCELERATION_SCURVE
+    // S-curve ramps peak at twice their average acceleration, see
+    // scurve_start(), so plan them with half of the limit.
+    scale >>= 1;
+  #endif
+  if (scale == 0)
+    scale = 1;
+  dda->accel_scale = scale;
+
+  // c0 goes with 1 / sqrt(acceleration).
+  dda->c0 = pgm_read_dword(&c0_P[dda->fast_axis]);
+  if (scale < 4096)
+    dda->c0 = muldiv(dda->c0, int_sqrt((1UL << 28) / scale), 256);
+}
+#endif
+
+#ifdef SLOWDOWN
+/*! Slow a short move down if the queue runs low.
+  \param *dda the move, endpoint.F gets lowered
+  \param distance length of the move, in um
+
+  A move taking less than SLOWDOWN milliseconds gets stretched towards that
+  time, by twice the difference divided by the number of moves queued before
+  it. Like the SLOWDOWN option of other firmwares. With no other move queued
+  the move starts from standstill anyways, with half the queue or more there
+  is enough time left for planning.
+*/
+static void dda_slowdown(DDA *dda, uint32_t distance) {
+  uint32_t t;
+  uint8_t queued = queue_waiting();
+
+  if (queued == 0 || queued >= MOVEBUFFER_SIZE / 2 || dda->endstop_check)
+    return;
+
+  // Duration in microseconds, F is mm/min.
+  t = muldiv(distance, 60000, dda->endpoint.F);
+  if (t < SLOWDOWN * 1000UL) {
+    t += 2 * (SLOWDOWN * 1000UL - t) / queued;
+    t = muldiv(distance, 60000, t);
+    if (t < dda->endpoint.F)
+      dda->endpoint.F = t ? t : 1;
+  }
+}
+#endif
+
+#ifdef LOOKAHEAD
+/*! Direction of a move for look-ahead.
+  \param *dda the move, with distance set
+  \param move_um distance moved by each axis, in um, signed
+
+  dda->unit[] gets the unit vector along the move, move_um[] divided by the
+  distance, scaled by 2^14. Multiplied with a feedrate, this gives the speed
+  of each axis, see dda_find_crossing_speed(). Done once per move, so
+  joining two moves takes no divisions.
+*/
+static void dda_unit_vector(DDA *dda, axes_int32_t move_um) {
+  enum axis_e i;
+  int32_t u;
+
+  for (i = X; i < AXIS_COUNT; i++) {
+    u = 0;
+    if (move_um[i])
+      u = muldiv(move_um[i], (uint32_t)1 << 14, dda->distance);
+    // E can move further than X, Y and Z together.
+    if (u > INT16_MAX)
+      u = INT16_MAX;
+    else if (u < -INT16_MAX)
+      u = -INT16_MAX;
+    dda->unit[i] = u;
+  }
+}
+#endif
+
+#ifdef ARC_SUPPORT
+#ifdef LOOKAHEAD
+/*! Set the movement direction of an arc for look-ahead.
+  \param *dda the arc
+  \param move_um distance moved by each axis, in um, signed
+  \param vx X of the point on the arc, relative to the center
+  \param vy Y of this point
+
+  Look-ahead sees an arc as a straight move along the tangent at its start
+  when joining with the previous move and along the tangent at its end when
+  joining with the next one. move_um[X] and [Y] get this tangent, scaled to
+  the length of the arc, for dda_unit_vector().
+*/
+static void dda_arc_tangent(DDA *dda, axes_int32_t move_um,
+                            int32_t vx, int32_t vy) {
+  uint32_t radius;
+
+  int_atan2(vy, vx, &radius);
+  if (radius == 0)
+    return;
+
+  if (dda->arc_angle < 0) {
+    vx = -vx;
+    vy = -vy;
+  }
+  move_um[X] = muldiv(-vy, dda->fast_um, radius);
+  move_um[Y] = muldiv(vx, dda->fast_um, radius);
+}
+#endif
+
+/*! Set up an arc.
+  \param *dda the move, with arc_center being the offset of the center from
+         the start point and the sign of arc_angle being the direction, see
+         enqueue_arc()
+  \param *target end point of the arc
+  \param delta_um distance moved by each axis, in um. X and Y get replaced by
+         the length of the arc
+
+  The path along the arc becomes the "fast axis" of the move, counted in
+  steps of X or Y, whichever accelerates slower, because the path turns into
+  both directions. All acceleration and look-ahead calculations work on this
+  path. dda_clock() splits it into chords, see fill_segments().
+
+  An arc with zero radius clears dda->arc and gets done as a straight move.
+*/
+static void dda_arc_create(DDA *dda, TARGET *target, axes_uint32_t delta_um) {
+  uint32_t radius, length, q;
+  int32_t angle;
+
+  dda->arc_start[X] = -dda->arc_center[X];
+  dda->arc_start[Y] = -dda->arc_center[Y];
+  dda->arc_center[X] += startpoint.axis[X];
+  dda->arc_center[Y] += startpoint.axis[Y];
+
+  angle = int_atan2(dda->arc_start[Y], dda->arc_start[X], &radius);
+  if (radius == 0) {
+    dda->arc = 0;
+    return;
+  }
+  angle = int_atan2(target->axis[Y] - dda->arc_center[Y],
+                    target->axis[X] - dda->arc_center[X], NULL) - angle;
+
+  // Same start and end point means a full circle.
+  if (dda->arc_angle > 0) {
+    if (angle <= 0)
+      angle += 2 * ANGLE_PI;
+  }
+  else if (angle >= 0)
+    angle -= 2 * ANGLE_PI;
+  dda->arc_angle = angle;
+
+  length = muldiv(radius, labs(angle), 1UL << 28);
+
+  dda->fast_axis = X;
+  if (pgm_read_dword(&acceleration_P[Y]) < pgm_read_dword(&acceleration_P[X]))
+    dda->fast_axis = Y;
+  dda->fast_um = length;
+  dda->total_steps = um_to_steps(length, dda->fast_axis);
+  delta_um[X] = delta_um[Y] = length;
+
+  // A chord of length s deviates by s^2 / (8 * r) from the arc.
+  q = um_to_steps(int_sqrt(8UL * ARC_TOLERANCE * radius), dda->fast_axis);
+  if (q > 0xFFFF)
+    q = 0xFFFF;
+  dda->arc_chord = q ? q : 1;
+
+  // Centripetal acceleration, v^2 / r, is limited like any other. In mm/min
+  // and um: F^2 = 3600 * a * r / 1000 = (a * 16) * r * 9 / 40.
+  q = muldiv(radius, pgm_read_dword(&acceleration_P[dda->fast_axis]), 40);
+  if (q < 0xFFFFFFFF / 9) {
+    q = int_sqrt(q * 9);
+    if (q == 0)
+      q = 1;
+    if (dda->endpoint.F > q)
+      dda->endpoint.F = q;
+  }
 }
+#endif /* ARC_SUPPORT */
 
 /*! CREATE a dda given current_position and a target, save to passed location so we can write directly into the queue
 	\param *dda pointer to a dda_queue entry to overwrite
@@ -143,37 +770,59 @@ void dda_new_startpoint(void) {
  * 1. Standard movement. To be joined with the previous move.
  * 2. Movement after a pause. This interrupts lookahead, and invalidates
  *    prev_dda and prev_distance.
- * 3. Non-move, e.g. a wait for temp. This also interrupts lookahead and makes
- *    prev_dda and prev_distance invalid. There might be more such cases in the
- *    future, e.g. when heater or fan changes are queued up, too.
+ * 3. Non-move, e.g. a wait for temp or a dwell. This also interrupts
+ *    lookahead and makes prev_dda and prev_distance invalid. Queued heater
+ *    and fan changes don't, see enqueue_action().
  * 4. Nullmove due to no movement expected, e.g. a pure speed change. This
- *    shouldn't interrupt lookahead and be handled af if the change would come
- *    with the next movement.
- * 5. Nullmove due to movement smaller than a single step. Shouldn't interrupt
- *    lookahead either, but this small distance should be added to the next
- *    movement.
+ *    doesn't interrupt lookahead, the move doesn't get queued and the change
+ *    comes with the next movement.
+ * 5. Nullmove due to movement smaller than a single step. Handled the same,
+ *    the small distance gets added to the next movement. Steps count from
+ *    startpoint_steps, so X, Y, Z and absolute E lose nothing anyway,
+ *    relative E counts from a sum of its distances, see e_relative.
  * 6. Lookahead calculation too slow. This is handled in dda_join_moves()
  *    already.
  */
 void dda_create(DDA *dda, TARGET *target) {
   axes_uint32_t delta_um;
   axes_int32_t steps;
+  TARGET *start = &startpoint;
 	uint32_t	distance, c_limit, c_limit_calc;
   enum axis_e i;
   #ifdef LOOKAHEAD
+  // Same as delta_um, but signed, for the unit vector.
+  axes_int32_t move_um;
   // Number the moves to identify them; allowed to overflow.
   static uint8_t idcnt = 0;
   static DDA* prev_dda = NULL;
 
-  if ((prev_dda && prev_dda->done) || dda->waitfor_temp)
+  // Endstop searches end wherever the endstop is, don't join them.
+  if ((prev_dda && (prev_dda->done || prev_dda->endstop_check)) ||
+      dda->waitfor_temp || dda->set_position || dda->endstop_check ||
+      dda->action == ACTION_DWELL)
     prev_dda = NULL;
   #endif
 
-  if (dda->waitfor_temp)
+  // Other actions are transparent to look-ahead, it joins the moves before
+  // and after them, see dda_join_moves().
+  if (dda->waitfor_temp || dda->action)
     return;
 
+  // Step positions, see enqueue_position().
+  if (dda->set_position) {
+    memcpy(&(dda->endpoint), target, sizeof(TARGET));
+    return;
+  }
+
   // We end at the passed target.
   memcpy(&(dda->endpoint), target, sizeof(TARGET));
+  #ifndef ACCELERATION_RAMPING
+    // Feed override, see M220. Ramping applies it along with the speed
+    // limits of the axes, see dda_override_F(). Endstop searches keep their
+    // feedrate, ENDSTOP_CLEARANCE_{XYZ} depends on it.
+    if ( ! dda->endstop_check)
+      dda->endpoint.F = muldiv(target->F, feed_override, 100);
+  #endif
 
 	if (DEBUG_DDA && (debug_flags & DEBUG_DDA))
     sersendf_P(PSTR("\nCreate: X %lq  Y %lq  Z %lq  F %lu\n"),
@@ -184,13 +833,23 @@ void dda_create(DDA *dda, TARGET *target) {
     // Set the start and stop speeds to zero for now = full stops between
     // moves. Also fallback if lookahead calculations fail to finish in time.
     dda->crossF = 0;
+    dda->max_entry = 0;
     dda->start_steps = 0;
     dda->end_steps = 0;
     // Give this move an identifier.
     dda->id = idcnt++;
   #endif
 
-  code_axes_to_stepper_axes(&startpoint, target, delta_um, steps);
+  // Moves too small to get queued add their distance to this one.
+  if (substep_pending
+      #ifdef ARC_SUPPORT
+        && ! dda->arc
+      #endif
+     )
+    start = &substep_start;
+  substep_pending = 0;
+
+  code_axes_to_stepper_axes(start, target, delta_um, steps);
   for (i = X; i < E; i++) {
     int32_t delta_steps;
 
@@ -200,55 +859,67 @@ void dda_create(DDA *dda, TARGET *target) {
 
     set_direction(dda, i, delta_steps);
     #ifdef LOOKAHEAD
-      // Also displacements in micrometers, but for the lookahead alogrithms.
-      // TODO: this is redundant. delta_um[] and dda->delta_um[] differ by
-      //       just signedness and storage location. Ideally, dda is used
-      //       as storage place only if neccessary (LOOKAHEAD turned on?)
-      //       because this space is multiplied by the movement queue size.
-      //
-      // Update 2014/10: it was tried to use delta_um[]'s sign to set stepper
-      //                 direction in dda_start() to allow getting rid of
-      //                 some of this redundancy, but this increases dda_start()
-      //                 by at least 20 clock cycles. Not good for performance.
-      //                 Tried code can be found in the archive folder.
-      dda->delta_um[i] = (delta_steps >= 0) ?
-                         (int32_t)delta_um[i] : -(int32_t)delta_um[i];
+      move_um[i] = (delta_steps >= 0) ?
+                   (int32_t)delta_um[i] : -(int32_t)delta_um[i];
     #endif
   }
 
-  // TODO: this can likely be, at least partially, joined with the above for()
-  //       loop. Lots of almost-duplicate code.
-  if ( ! target->e_relative) {
-    int32_t delta_steps;
+  // E, moving the extruder of the current tool. Absolute E counts from
+  // startpoint_steps, relative E from zero. Both get scaled by the flow
+  // override afterwards, startpoint_steps stays unscaled.
+  {
+    enum axis_e e = TARGET_E_AXIS(target);
+    int32_t e_um, delta_steps;
+
+    #if EXTRUDERS > 1
+      for (i = E; i < AXIS_COUNT; i++) {
+        delta_um[i] = 0;
+        dda->delta[i] = 0;
+        #ifdef LOOKAHEAD
+          move_um[i] = 0;
+        #endif
+      }
+    #endif
 
-    delta_um[E] = (uint32_t)labs(target->axis[E] - startpoint.axis[E]);
-    steps[E] = um_to_steps(target->axis[E], E);
+    if (target->e_relative) {
+      // Rounding each distance to steps on its own would lose up to half a
+      // step per move.
+      e_um = target->axis[E];
+      e_relative.um += e_um;
+      steps[e] = um_to_steps(e_relative.um, e);
+      delta_steps = steps[e] - e_relative.steps;
+      e_relative.steps = steps[e];
+      // Without G92 the sum grows forever, keep it within a metre. Whole
+      // metres convert to steps exactly.
+      while (e_relative.um >= (int32_t)UM_PER_METER) {
+        e_relative.um -= UM_PER_METER;
+        e_relative.steps -= pgm_read_dword(&axis_steps_per_m_P[e]);
+      }
+      while (e_relative.um <= -(int32_t)UM_PER_METER) {
+        e_relative.um += UM_PER_METER;
+        e_relative.steps += pgm_read_dword(&axis_steps_per_m_P[e]);
+      }
+    }
+    else {
+      e_um = target->axis[E] - start->axis[E];
+      steps[e] = um_to_steps(target->axis[E], e);
+      delta_steps = steps[e] - startpoint_steps.axis[e];
+      startpoint_steps.axis[e] = steps[e];
+    }
 
-    delta_steps = steps[E] - startpoint_steps.axis[E];
-    dda->delta[E] = (uint32_t)labs(delta_steps);
-    startpoint_steps.axis[E] = steps[E];
+    if (flow_override != 100) {
+      e_um = muldiv(e_um, flow_override, 100);
+      delta_steps = dda_flow_steps(delta_steps, e);
+    }
 
-    set_direction(dda, E, delta_steps);
+    delta_um[e] = (uint32_t)labs(e_um);
+    dda->delta[e] = (uint32_t)labs(delta_steps);
+    set_direction(dda, e, delta_steps);
     #ifdef LOOKAHEAD
-      // Also displacements in micrometers, but for the lookahead alogrithms.
-      // TODO: this is redundant. delta_um[] and dda->delta_um[] differ by
-      //       just signedness and storage location. Ideally, dda is used
-      //       as storage place only if neccessary (LOOKAHEAD turned on?)
-      //       because this space is multiplied by the movement queue size.
-      dda->delta_um[E] = (delta_steps >= 0) ?
-                         (int32_t)delta_um[E] : -(int32_t)delta_um[E];
+      move_um[e] = (delta_steps >= 0) ?
+                   (int32_t)delta_um[e] : -(int32_t)delta_um[e];
     #endif
   }
-  else {
-    // When we get more extruder axes:
-    // for (i = E; i < AXIS_COUNT; i++) { ...
-    delta_um[E] = (uint32_t)labs(target->axis[E]);
-    dda->delta[E] = (uint32_t)labs(um_to_steps(target->axis[E], E));
-    #ifdef LOOKAHEAD
-      dda->delta_um[E] = target->axis[E];
-    #endif
-    dda->e_direction = (target->axis[E] >= 0)?1:0;
-	}
 
 	if (DEBUG_DDA && (debug_flags & DEBUG_DDA))
     sersendf_P(PSTR("[%ld,%ld,%ld,%ld]"),
@@ -260,20 +931,82 @@ void dda_create(DDA *dda, TARGET *target) {
   // sure, but my feeling says that when we achieve true circles and Beziers,
   // we'll have total_steps which matches neither of X, Y, Z or E. Accordingly,
   // keep it for now. --Traumflug
+  #ifdef ARC_SUPPORT
+    if (dda->arc)
+      dda_arc_create(dda, target, delta_um);
+    if ( ! dda->arc)
+  #endif
   for (i = X; i < AXIS_COUNT; i++) {
     if (i == X || dda->delta[i] > dda->total_steps) {
       dda->fast_axis = i;
       dda->total_steps = dda->delta[i];
       dda->fast_um = delta_um[i];
-      dda->fast_spm = pgm_read_dword(&steps_per_m_P[i]);
     }
   }
 
+  #ifdef PRESSURE_ADVANCE
+    // E steps of moves led by another axis come from dda_clock(), see
+    // fill_segments(). Arcs do E along with their chords.
+    dda->advance = (dda->fast_axis != E);
+    #ifdef ARC_SUPPORT
+      if (dda->arc)
+        dda->advance = 0;
+    #endif
+  #endif
+
+  // Pick the dda_step() variant covering all moving axes with the fewest
+  // axes to look at.
+  dda->axes = 0;
+  for (i = X; i < AXIS_COUNT; i++)
+    if (dda->delta[i])
+      dda->axes |= 1 << i;
+  #ifdef ARC_SUPPORT
+    if (dda->arc)
+      dda->axes = AXES_ALL;
+  #endif
+  #ifdef PRESSURE_ADVANCE
+    if (dda->advance)
+      dda->axes &= ~AXES_E;
+  #endif
+  if ((dda->axes & ~AXES_XY) == 0)
+    dda->axes = AXES_XY;
+  else if ((dda->axes & ~AXES_XYE) == 0)
+    dda->axes = AXES_XYE;
+  #if EXTRUDERS > 1
+  else if ((dda->axes & ~AXES_XYE1) == 0)
+    dda->axes = AXES_XYE1;
+  #endif
+  #if EXTRUDERS > 2
+  else if ((dda->axes & ~AXES_XYE2) == 0)
+    dda->axes = AXES_XYE2;
+  #endif
+  else if ((dda->axes & ~AXES_XYZ) == 0 && dda->axes != AXES_Z)
+    dda->axes = AXES_XYZ;
+  else if (dda->axes != AXES_Z && dda->axes != AXES_E
+           #if EXTRUDERS > 1
+           && dda->axes != AXES_E1
+           #endif
+           #if EXTRUDERS > 2
+           && dda->axes != AXES_E2
+           #endif
+          )
+    dda->axes = AXES_ALL;
+
 	if (DEBUG_DDA && (debug_flags & DEBUG_DDA))
     sersendf_P(PSTR(" [ts:%lu"), dda->total_steps);
 
 	if (dda->total_steps == 0) {
 		dda->nullmove = 1;
+
+    // Not queued, see enqueue_home(). The next move starts where this one
+    // did and joins with the one before.
+    if ( ! dda->endstop_check) {
+      if (start == &startpoint)
+        memcpy(&substep_start, &startpoint, sizeof(TARGET));
+      substep_pending = 1;
+      memcpy(&startpoint, target, sizeof(TARGET));
+      return;
+    }
 	}
 	else {
 		// get steppers ready to go
@@ -283,8 +1016,21 @@ void dda_create(DDA *dda, TARGET *target) {
 		y_enable();
 		// Z is enabled in dda_start()
 		e_enable();
+    #if EXTRUDERS > 1
+      if (dda->delta[E1])
+        e1_enable();
+    #endif
+    #if EXTRUDERS > 2
+      if (dda->delta[E2])
+        e2_enable();
+    #endif
 
 		// since it's unusual to combine X, Y and Z changes in a single move on reprap, check if we can use simpler approximations before trying the full 3d approximation.
+    #ifdef ARC_SUPPORT
+    if (dda->arc)
+      distance = approx_distance(dda->fast_um, delta_um[Z]);
+    else
+    #endif
 		if (delta_um[Z] == 0)
 			distance = approx_distance(delta_um[X], delta_um[Y]);
 		else if (delta_um[X] == 0 && delta_um[Y] == 0)
@@ -293,7 +1039,11 @@ void dda_create(DDA *dda, TARGET *target) {
 			distance = approx_distance_3(delta_um[X], delta_um[Y], delta_um[Z]);
 
 		if (distance < 2)
-			distance = delta_um[E];
+			distance = delta_um[TARGET_E_AXIS(target)];
+
+    #ifdef SLOWDOWN
+      dda_slowdown(dda, distance);
+    #endif
 
 		if (DEBUG_DDA && (debug_flags & DEBUG_DDA))
 			sersendf_P(PSTR(",ds:%lu"), distance);
@@ -303,7 +1053,7 @@ void dda_create(DDA *dda, TARGET *target) {
       // 60 * 16 MHz * 5 mm is > 32 bits
       uint32_t move_duration, md_candidate;
 
-      move_duration = distance * ((60 * F_CPU) / (target->F * 1000UL));
+      move_duration = distance * ((60 * F_CPU) / (dda->endpoint.F * 1000UL));
       for (i = X; i < AXIS_COUNT; i++) {
         md_candidate = dda->delta[i] * ((60 * F_CPU) /
                        (pgm_read_dword(&maximum_feedrate_P[i]) * 1000UL));
@@ -349,7 +1099,7 @@ void dda_create(DDA *dda, TARGET *target) {
     dda->c = move_duration / startpoint.F;
     if (dda->c < c_limit)
       dda->c = c_limit;
-    dda->end_c = move_duration / target->F;
+    dda->end_c = move_duration / dda->endpoint.F;
     if (dda->end_c < c_limit)
       dda->end_c = c_limit;
 
@@ -358,7 +1108,7 @@ void dda_create(DDA *dda, TARGET *target) {
 
     if (dda->c != dda->end_c) {
 			uint32_t stF = startpoint.F / 4;
-			uint32_t enF = target->F / 4;
+			uint32_t enF = dda->endpoint.F / 4;
 			// now some constant acceleration stuff, courtesy of http://www.embedded.com/design/mcus-processors-and-socs/4006438/Generate-stepper-motor-speed-profiles-in-real-time
 			uint32_t ssq = (stF * stF);
 			uint32_t esq = (enF * enF);
@@ -398,21 +1148,31 @@ void dda_create(DDA *dda, TARGET *target) {
 		else
 			dda->accel = 0;
 		#elif defined ACCELERATION_RAMPING
-			// yes, this assumes always the x axis as the critical one regarding acceleration. If we want to implement per-axis acceleration, things get tricky ...
-      dda->c_min = move_duration / target->F;
-      if (dda->c_min < c_limit) {
-        dda->c_min = c_limit;
-        dda->endpoint.F = move_duration / dda->c_min;
-      }
+      dda_find_acceleration(dda, delta_um);
+
+      // Keep what's needed to find the cruise speed for another feed
+      // override, see dda_override_F(). Lookahead can deal with 16 bits
+      // ( = 1092 mm/s), only.
+      c_limit_calc = c_limit ? move_duration / c_limit : 65535;
+      if (c_limit_calc > 65535)
+        c_limit_calc = 65535;
+      #if defined ARC_SUPPORT || defined SLOWDOWN
+        // Arcs limit endpoint.F to their centripetal acceleration, SLOWDOWN
+        // to the time needed to plan the next move. Feed override can't
+        // go above either.
+        if (dda->endpoint.F < target->F && dda->endpoint.F < c_limit_calc)
+          c_limit_calc = dda->endpoint.F;
+      #endif
+      dda->F_max = c_limit_calc;
+      dda->F_nominal = (target->F > 65535) ? 65535 : target->F;
+      dda->move_duration = move_duration;
 
-      // Lookahead can deal with 16 bits ( = 1092 mm/s), only.
-      if (dda->endpoint.F > 65535)
-        dda->endpoint.F = 65535;
+      dda->endpoint.F = dda_override_F(dda);
+      dda->c_min = move_duration / dda->endpoint.F;
 
       // Acceleration ramps are based on the fast axis, not the combined speed.
       dda->rampup_steps =
-        acc_ramp_len(muldiv(dda->fast_um, dda->endpoint.F, distance),
-                     dda->fast_spm);
+        dda_ramp_len(dda, muldiv(dda->fast_um, dda->endpoint.F, distance));
 
       if (dda->rampup_steps > dda->total_steps / 2)
         dda->rampup_steps = dda->total_steps / 2;
@@ -420,22 +1180,29 @@ void dda_create(DDA *dda, TARGET *target) {
 
       #ifdef LOOKAHEAD
         dda->distance = distance;
+        #ifdef ARC_SUPPORT
+          // The previous move joins at the start of the arc.
+          if (dda->arc)
+            dda_arc_tangent(dda, move_um,
+                            dda->arc_start[X], dda->arc_start[Y]);
+        #endif
+        dda_unit_vector(dda, move_um);
         dda_find_crossing_speed(prev_dda, dda);
-        // TODO: this should become a reverse-stepping through the existing
-        //       movement queue to allow higher speeds for short moves.
-        //       dda_find_crossing_speed() is required only once.
+        // This also re-plans earlier moves in the queue, as far back as
+        // their entry speeds can be raised.
         dda_join_moves(prev_dda, dda);
-        dda->n = dda->start_steps;
-        if (dda->n == 0)
-          dda->c = pgm_read_dword(&c0_P[dda->fast_axis]);
-        else
-          dda->c = (pgm_read_dword(&c0_P[dda->fast_axis]) *
-                    int_inv_sqrt(dda->n)) >> 13;
-        if (dda->c < dda->c_min)
-          dda->c = dda->c_min;
+        #ifdef ARC_SUPPORT
+          // The next move joins at the end of the arc.
+          if (dda->arc) {
+            dda_arc_tangent(dda, move_um,
+                            target->axis[X] - dda->arc_center[X],
+                            target->axis[Y] - dda->arc_center[Y]);
+            dda_unit_vector(dda, move_um);
+          }
+        #endif
+        dda->c = dda_ramp_c(dda, dda->start_steps);
       #else
-        dda->n = 0;
-        dda->c = pgm_read_dword(&c0_P[dda->fast_axis]);
+        dda->c = dda->c0;
       #endif
 
 		#elif defined ACCELERATION_TEMPORAL
@@ -456,7 +1223,7 @@ void dda_create(DDA *dda, TARGET *target) {
       }
 
 		#else
-      dda->c = move_duration / target->F;
+      dda->c = move_duration / dda->endpoint.F;
       if (dda->c < c_limit)
         dda->c = c_limit;
 		#endif
@@ -472,6 +1239,101 @@ void dda_create(DDA *dda, TARGET *target) {
   #endif
 }
 
+#ifdef ACCELERATION_RAMPING
+/*! Acceleration ramp length of a move.
+  \param *dda the move, providing the fast axis and its acceleration
+  \param feedrate target feedrate of the fast axis, in mm/min
+  \return steps of the fast axis needed to accelerate from standstill
+
+  Same as acc_ramp_len(), but takes the acceleration of this move into
+  account, which can be lower than the one of its fast axis.
+*/
+uint32_t dda_ramp_len(DDA *dda, uint32_t feedrate) {
+  uint32_t n = acc_ramp_len(feedrate, dda->fast_axis);
+
+  if (dda->accel_scale < 4096)
+    n = muldiv(n, 4096, dda->accel_scale);
+
+  return n;
+}
+
+/*! Step delay for a given position on the acceleration ramp.
+  \param *dda the move, providing c0 and the maximum speed
+  \param n number of steps on the ramp, counted from standstill
+  \return delay until the next step in CPU ticks, limited by dda->c_min
+
+  Explicit formula: c0 * (sqrt(n + 1) - sqrt(n)),
+  approximation here: c0 * (1 / (2 * sqrt(n))).
+*/
+uint32_t dda_ramp_c(DDA *dda, uint32_t n) {
+  uint32_t c;
+
+  if (n == 0)
+    c = dda->c0;
+  else
+    #ifdef RAMP_LOOKUP_TABLE
+      c = ramp_table_c(dda->c0, n);
+    #else
+      c = muldiv(int_inv_sqrt(n), dda->c0, 8192);
+    #endif
+  if (c < dda->c_min)
+    c = dda->c_min;
+
+  return c;
+}
+
+/*! Ramp position for a given step delay, the inverse of dda_ramp_c().
+  \param *dda the move, providing c0
+  \param c delay between two steps, in CPU ticks
+  \return ramp position, n = (c0 / (2 * c))^2
+*/
+static uint32_t dda_ramp_n(DDA *dda, uint32_t c) {
+  uint32_t n = muldiv(dda->c0, 16, c);
+
+  return muldiv(n, n, 1024);
+}
+
+/*! Feedrate of a move at the current feed override.
+  \param *dda the move
+  \return feedrate in mm/min, within the limits of the axes
+
+  The matching step delay is dda->move_duration / feedrate.
+*/
+uint32_t dda_override_F(DDA *dda) {
+  uint32_t F = dda->F_nominal;
+
+  // Endstop searches keep their feedrate, see ENDSTOP_CLEARANCE_X.
+  if ( ! dda->endstop_check)
+    F = muldiv(F, feed_override, 100);
+  if (F > dda->F_max)
+    F = dda->F_max;
+
+  return F ? F : 1;
+}
+#endif
+
+#ifdef ACCELERATION_RAMPING
+/*! Set up a RAMP_STATE for the start of a move.
+  \param *dda the move
+  \param *ramp its RAMP_STATE
+  \param head index in move_state.segments[] for its first segment
+*/
+static void ramp_state_init(DDA *dda, RAMP_STATE *ramp, uint8_t head) {
+  ramp->step_no = 1;
+  ramp->seg_head = head;
+  ramp->ramp_step = 0;
+  #ifdef LOOKAHEAD
+    ramp->ramp_base = dda->start_steps;
+  #else
+    ramp->ramp_base = 0;
+  #endif
+  ramp->ramp_slow = 0;
+  #ifdef ACCELERATION_SCURVE
+    ramp->ramp_phase = 0;
+  #endif
+}
+#endif
+
 /*! Start a prepared DDA
 	\param *dda pointer to entry in dda_queue to start
 
@@ -486,6 +1348,12 @@ void dda_create(DDA *dda, TARGET *target) {
 void dda_start(DDA *dda) {
 	// called from interrupt context: keep it simple!
 
+  // New origin from homing or a tool change, see enqueue_position().
+  if (dda->set_position) {
+    memcpy(move_state.position, dda->endpoint.axis, sizeof(axes_int32_t));
+    return;
+  }
+
   if (DEBUG_DDA && (debug_flags & DEBUG_DDA))
     sersendf_P(PSTR("Start: X %lq  Y %lq  Z %lq  F %lu\n"),
                dda->endpoint.axis[X], dda->endpoint.axis[Y],
@@ -504,6 +1372,12 @@ void dda_start(DDA *dda) {
 		y_direction(dda->y_direction);
 		z_direction(dda->z_direction);
 		e_direction(dda->e_direction);
+    #if EXTRUDERS > 1
+      e1_direction(dda->e1_direction);
+    #endif
+    #if EXTRUDERS > 2
+      e2_direction(dda->e2_direction);
+    #endif
 
 		#ifdef	DC_EXTRUDER
     if (dda->delta[E])
@@ -513,19 +1387,80 @@ void dda_start(DDA *dda) {
 		// initialise state variable
     move_state.counter[X] = move_state.counter[Y] = move_state.counter[Z] = \
       move_state.counter[E] = -(dda->total_steps >> 1);
-    memcpy(&move_state.steps[X], &dda->delta[X], sizeof(uint32_t) * 4);
+    #if EXTRUDERS > 1
+      move_state.counter[E1] = move_state.counter[E];
+    #endif
+    #if EXTRUDERS > 2
+      move_state.counter[E2] = move_state.counter[E];
+    #endif
+    memcpy(&move_state.steps[X], &dda->delta[X], sizeof(axes_uint32_t));
     move_state.endstop_stop = 0;
+    move_state.endstop_check = dda->endstop_check;
+    if (dda->endstop_check) {
+      uint8_t hit;
+
+      // Searching several endstops, the first one triggering stops the
+      // move, the next move searches on. Axes already at their endstop
+      // don't move there, see home_phase(). No delta either, for
+      // dda_position_add().
+      hit = dda_endstops(dda, dda->endstop_check);
+      if (hit & 0x03)
+        move_state.steps[X] = dda->delta[X] = 0;
+      if (hit & 0x0C)
+        move_state.steps[Y] = dda->delta[Y] = 0;
+      if (hit & 0x30)
+        move_state.steps[Z] = dda->delta[Z] = 0;
+      move_state.endstop_check &= ~hit;
+    }
 		#ifdef ACCELERATION_RAMPING
-			move_state.step_no = 0;
+      // The first step is done at dda->c, everything else comes from
+      // segments queued by dda_clock().
+      move_state.seg_steps = 1;
+      move_state.batch = 1;
+      if (dda == prepared && move_state.seg_tail == prepared_tail) {
+        // Queued while the previous move was running, see dda_prepare().
+        move_state.ramp = (move_state.ramp == &ramp_state[0]) ?
+                          &ramp_state[1] : &ramp_state[0];
+      }
+      else {
+        move_state.seg_tail = 0;
+        ramp_state_init(dda, move_state.ramp, 0);
+      }
+      prepared = NULL;
 		#endif
+    #ifdef ARC_SUPPORT
+      // Arcs step in chords only, the first interrupt just waits for them.
+      if (dda->arc) {
+        memset(&move_state.steps[X], 0, sizeof(axes_uint32_t));
+        move_state.ramp->step_no = 0;
+      }
+    #endif
+    #ifdef PRESSURE_ADVANCE
+      // E steps wait for the first segment.
+      if (dda->advance)
+        move_state.steps[E] = 0;
+    #endif
 		#ifdef ACCELERATION_TEMPORAL
       move_state.time[X] = move_state.time[Y] = \
         move_state.time[Z] = move_state.time[E] = 0UL;
+      #if EXTRUDERS > 1
+        move_state.time[E1] = 0UL;
+      #endif
+      #if EXTRUDERS > 2
+        move_state.time[E2] = 0UL;
+      #endif
 		#endif
 
 		// ensure this dda starts
 		dda->live = 1;
 
+    #ifdef ENDSTOP_INTERRUPT
+      // Endstops already in stop condition don't change their pin.
+      move_state.endstop_edge = 0;
+      if (move_state.endstop_check)
+        dda_endstop_edge(dda);
+    #endif
+
 		// set timeout for first step
     setTimer(dda->c);
 	}
@@ -534,35 +1469,29 @@ void dda_start(DDA *dda) {
 	current_position.F = dda->endpoint.F;
 }
 
-/**
-  \brief Do per-step movement maintenance.
-
+/*! Step each axis due, according to Bresenham.
   \param *dda the current move
+  \param delta steps to do on each axis, usually dda->delta
+  \param total steps of the fast axis, usually dda->total_steps
+  \param axes axes to look at, see dda->axes. A constant, so code for the
+         other axes gets dropped at compile time.
+  \return bool: steps left on any of these axes?
 
-  \details Most important task here is to update the Bresenham algorithm and
-  to generate step pulses accordingly, this guarantees geometrical accuracy
-  of the movement. Other tasks, like acceleration calculations, are moved
-  into dda_clock() as much as possible.
-
-  This is called from our timer interrupt every time a step needs to occur.
-  Keep it as simple and fast as possible, this is most critical for the
-  achievable step frequency.
-
-  Note: it was tried to do this in loops instead of straight, repeating code.
-        However, this resulted in at least 16% performance loss, no matter
-        how it was done. On how to measure, see commit "testcases: Add
-        config.h". On the various tries and measurement results, see commits
-        starting with "DDA: Move axis calculations into loops, part 6".
+  Part of dda_step(), inlined there.
 */
-void dda_step(DDA *dda) {
+static uint8_t dda_axis_steps(DDA *dda, uint32_t *delta, uint32_t total,
+                              const uint8_t axes)
+  __attribute__ ((always_inline));
+inline uint8_t dda_axis_steps(DDA *dda, uint32_t *delta, uint32_t total,
+                              const uint8_t axes) {
 
 #if ! defined ACCELERATION_TEMPORAL
-  if (move_state.steps[X]) {
-    move_state.counter[X] -= dda->delta[X];
+  if ((axes & (1 << X)) && move_state.steps[X]) {
+    move_state.counter[X] -= delta[X];
     if (move_state.counter[X] < 0) {
 			x_step();
       move_state.steps[X]--;
-      move_state.counter[X] += dda->total_steps;
+      move_state.counter[X] += total;
 		}
 	}
 #else	// ACCELERATION_TEMPORAL
@@ -575,12 +1504,12 @@ void dda_step(DDA *dda) {
 #endif
 
 #if ! defined ACCELERATION_TEMPORAL
-  if (move_state.steps[Y]) {
-    move_state.counter[Y] -= dda->delta[Y];
+  if ((axes & (1 << Y)) && move_state.steps[Y]) {
+    move_state.counter[Y] -= delta[Y];
     if (move_state.counter[Y] < 0) {
 			y_step();
       move_state.steps[Y]--;
-      move_state.counter[Y] += dda->total_steps;
+      move_state.counter[Y] += total;
 		}
 	}
 #else	// ACCELERATION_TEMPORAL
@@ -593,12 +1522,12 @@ void dda_step(DDA *dda) {
 #endif
 
 #if ! defined ACCELERATION_TEMPORAL
-  if (move_state.steps[Z]) {
-    move_state.counter[Z] -= dda->delta[Z];
+  if ((axes & (1 << Z)) && move_state.steps[Z]) {
+    move_state.counter[Z] -= delta[Z];
     if (move_state.counter[Z] < 0) {
 			z_step();
       move_state.steps[Z]--;
-      move_state.counter[Z] += dda->total_steps;
+      move_state.counter[Z] += total;
 		}
 	}
 #else	// ACCELERATION_TEMPORAL
@@ -611,12 +1540,12 @@ void dda_step(DDA *dda) {
 #endif
 
 #if ! defined ACCELERATION_TEMPORAL
-  if (move_state.steps[E]) {
-    move_state.counter[E] -= dda->delta[E];
+  if ((axes & (1 << E)) && move_state.steps[E]) {
+    move_state.counter[E] -= delta[E];
     if (move_state.counter[E] < 0) {
 			e_step();
       move_state.steps[E]--;
-      move_state.counter[E] += dda->total_steps;
+      move_state.counter[E] += total;
 		}
 	}
 #else	// ACCELERATION_TEMPORAL
@@ -628,6 +1557,207 @@ void dda_step(DDA *dda) {
 	}
 #endif
 
+#if EXTRUDERS > 1
+#if ! defined ACCELERATION_TEMPORAL
+  if ((axes & (1 << E1)) && move_state.steps[E1]) {
+    move_state.counter[E1] -= delta[E1];
+    if (move_state.counter[E1] < 0) {
+			e1_step();
+      move_state.steps[E1]--;
+      move_state.counter[E1] += total;
+		}
+	}
+#else	// ACCELERATION_TEMPORAL
+	if (dda->axis_to_step == E1) {
+		e1_step();
+    move_state.steps[E1]--;
+    move_state.time[E1] += dda->step_interval[E1];
+    move_state.all_time = move_state.time[E1];
+	}
+#endif
+#endif /* EXTRUDERS > 1 */
+
+#if EXTRUDERS > 2
+#if ! defined ACCELERATION_TEMPORAL
+  if ((axes & (1 << E2)) && move_state.steps[E2]) {
+    move_state.counter[E2] -= delta[E2];
+    if (move_state.counter[E2] < 0) {
+			e2_step();
+      move_state.steps[E2]--;
+      move_state.counter[E2] += total;
+		}
+	}
+#else	// ACCELERATION_TEMPORAL
+	if (dda->axis_to_step == E2) {
+		e2_step();
+    move_state.steps[E2]--;
+    move_state.time[E2] += dda->step_interval[E2];
+    move_state.all_time = move_state.time[E2];
+	}
+#endif
+#endif /* EXTRUDERS > 2 */
+
+  return ((axes & (1 << X)) && move_state.steps[X]) ||
+         ((axes & (1 << Y)) && move_state.steps[Y]) ||
+         ((axes & (1 << Z)) && move_state.steps[Z]) ||
+         ((axes & (1 << E)) && move_state.steps[E])
+         #if EXTRUDERS > 1
+         || ((axes & (1 << E1)) && move_state.steps[E1])
+         #endif
+         #if EXTRUDERS > 2
+         || ((axes & (1 << E2)) && move_state.steps[E2])
+         #endif
+         ;
+}
+
+#ifdef PRESSURE_ADVANCE
+/*! Step E according to the current segment, see PRESSURE_ADVANCE.
+
+  Bresenham like dda_axis_steps(), but over the steps of the segment instead
+  of the whole move.
+
+  Part of dda_step(), inlined there.
+*/
+static void dda_advance_step(void) __attribute__ ((always_inline));
+inline void dda_advance_step(void) {
+  if (move_state.steps[E]) {
+    move_state.counter[E] -= move_state.e_delta;
+    if (move_state.counter[E] < 0) {
+      e_step();
+      move_state.counter[E] += move_state.e_total;
+      move_state.steps[E]--;
+    }
+  }
+}
+
+/*! Start E stepping of the next segment.
+  \param *seg the segment
+
+  Part of dda_step(), inlined there.
+*/
+static void dda_advance_start(SEGMENT *seg) __attribute__ ((always_inline));
+inline void dda_advance_start(SEGMENT *seg) {
+  e_direction(seg->e_direction);
+  move_state.e_total = seg->steps;
+  move_state.counter[E] = -(seg->steps >> 1);
+  move_state.steps[E] = move_state.e_delta = seg->e_steps;
+}
+#endif
+
+/*! Step a straight move, with code specialised for the axes it moves.
+  \param *dda the current move
+  \return bool: steps left?
+
+  Axes not moving are skipped entirely instead of testing their step
+  counters on each step interrupt. Which variant to use is found in
+  dda_create() already, see dda->axes.
+
+  Part of dda_step(), inlined there.
+*/
+static uint8_t dda_line_steps(DDA *dda) __attribute__ ((always_inline));
+inline uint8_t dda_line_steps(DDA *dda) {
+  #ifdef PRESSURE_ADVANCE
+    if (dda->advance)
+      dda_advance_step();
+  #endif
+
+  switch (dda->axes) {
+    case AXES_XY:
+      return dda_axis_steps(dda, dda->delta, dda->total_steps, AXES_XY);
+    case AXES_XYE:
+      return dda_axis_steps(dda, dda->delta, dda->total_steps, AXES_XYE);
+    case AXES_XYZ:
+      return dda_axis_steps(dda, dda->delta, dda->total_steps, AXES_XYZ);
+    case AXES_Z:
+      return dda_axis_steps(dda, dda->delta, dda->total_steps, AXES_Z);
+    case AXES_E:
+      return dda_axis_steps(dda, dda->delta, dda->total_steps, AXES_E);
+    #if EXTRUDERS > 1
+    case AXES_XYE1:
+      return dda_axis_steps(dda, dda->delta, dda->total_steps, AXES_XYE1);
+    case AXES_E1:
+      return dda_axis_steps(dda, dda->delta, dda->total_steps, AXES_E1);
+    #endif
+    #if EXTRUDERS > 2
+    case AXES_XYE2:
+      return dda_axis_steps(dda, dda->delta, dda->total_steps, AXES_XYE2);
+    case AXES_E2:
+      return dda_axis_steps(dda, dda->delta, dda->total_steps, AXES_E2);
+    #endif
+    default:
+      return dda_axis_steps(dda, dda->delta, dda->total_steps, AXES_ALL);
+  }
+}
+
+#ifdef ARC_SUPPORT
+/*! Start the next chord of an arc.
+  \param *seg the segment holding the chord
+
+  Part of dda_step(), inlined there.
+*/
+static void dda_chord_start(SEGMENT *seg) __attribute__ ((always_inline));
+inline void dda_chord_start(SEGMENT *seg) {
+  enum axis_e i;
+
+  x_direction(seg->direction & 0x01);
+  y_direction((seg->direction >> 1) & 0x01);
+
+  move_state.chord_total = seg->steps;
+  for (i = X; i < AXIS_COUNT; i++) {
+    move_state.counter[i] = -(seg->steps >> 1);
+    move_state.steps[i] = move_state.chord_delta[i] = seg->delta[i];
+  }
+}
+#endif
+
+/**
+  \brief Do per-step movement maintenance.
+
+  \param *dda the current move
+
+  \details Most important task here is to update the Bresenham algorithm and
+  to generate step pulses accordingly, this guarantees geometrical accuracy
+  of the movement. Other tasks, like acceleration calculations, are moved
+  into dda_clock() as much as possible.
+
+  This is called from our timer interrupt every time a step needs to occur.
+  Keep it as simple and fast as possible, this is most critical for the
+  achievable step frequency.
+
+  Note: it was tried to do this in loops instead of straight, repeating code.
+        However, this resulted in at least 16% performance loss, no matter
+        how it was done. On how to measure, see commit "testcases: Add
+        config.h". On the various tries and measurement results, see commits
+        starting with "DDA: Move axis calculations into loops, part 6".
+*/
+void dda_step(DDA *dda) {
+  uint8_t steps_left;
+
+  #ifdef ARC_SUPPORT
+  if (dda->arc)
+    steps_left = dda_axis_steps(dda, move_state.chord_delta,
+                                move_state.chord_total, AXES_ALL);
+  else
+  #endif
+  #ifdef STEP_BATCH_RATE
+  {
+    uint8_t batch = move_state.batch;
+
+    // Above STEP_BATCH_RATE, a segment asks for more than one step per
+    // interrupt. These are done back to back, with just a short low time
+    // between the pulses, see also fill_segments().
+    for (;;) {
+      steps_left = dda_line_steps(dda);
+      if (--batch == 0 || ! steps_left)
+        break;
+      unstep();
+      delay_us(1);
+    }
+  }
+  #else
+    steps_left = dda_line_steps(dda);
+  #endif
+
 	#if STEP_INTERRUPT_INTERRUPTIBLE && ! defined ACCELERATION_RAMPING
 		// Since we have sent steps to all the motors that will be stepping
 		// and the rest of this function isn't so time critical, this interrupt
@@ -665,9 +1795,38 @@ void dda_step(DDA *dda) {
 		}
 	#endif
 
-	#ifdef ACCELERATION_RAMPING
-		move_state.step_no++;
-	#endif
+  #ifdef ACCELERATION_RAMPING
+    // Take the step rate from the next segment when the current one is done.
+    move_state.seg_steps -= move_state.batch;
+    if (move_state.seg_steps == 0) {
+      if (move_state.seg_tail != move_state.ramp->seg_head) {
+        dda->c = move_state.segments[move_state.seg_tail].c;
+        move_state.seg_steps = move_state.segments[move_state.seg_tail].steps;
+        move_state.batch = move_state.segments[move_state.seg_tail].batch;
+        #ifdef ARC_SUPPORT
+          if (dda->arc) {
+            dda_chord_start(&move_state.segments[move_state.seg_tail]);
+            steps_left = 1;
+          }
+        #endif
+        #ifdef PRESSURE_ADVANCE
+          if (dda->advance)
+            dda_advance_start(&move_state.segments[move_state.seg_tail]);
+        #endif
+        move_state.seg_tail = (move_state.seg_tail + 1) &
+                              (STEP_SEGMENT_BUFFER_SIZE - 1);
+      }
+      else {
+        // Segment queue ran dry, keep the step rate for one more interrupt.
+        move_state.seg_steps = move_state.batch;
+        #ifdef ARC_SUPPORT
+          // Arcs wait for the next chord without stepping.
+          if ( ! dda->arc)
+        #endif
+        move_state.ramp->step_no += move_state.batch;
+      }
+    }
+  #endif
 
   #ifdef ACCELERATION_TEMPORAL
     /** How is this ACCELERATION TEMPORAL expected to work?
@@ -704,15 +1863,36 @@ void dda_step(DDA *dda) {
     }
 	#endif
 
+  #ifdef ENDSTOP_INTERRUPT
+    // Stop as soon as an endstop trigger has lasted the debounce time.
+    if (move_state.endstop_edge && (uint16_t)(TCNT1 -
+        move_state.endstop_edge_time) >= (uint16_t)(ENDSTOP_INTERRUPT US))
+      dda_endstop_stop(dda);
+  #endif
+
   // If there are no steps left or an endstop stop happened, we have finished.
-  if ((move_state.steps[X] == 0 && move_state.steps[Y] == 0 &&
-       move_state.steps[Z] == 0 && move_state.steps[E] == 0)
+  if (( ! steps_left
+       #ifdef ARC_SUPPORT
+         // An arc is done after its last chord.
+         && ( ! dda->arc || (move_state.ramp->step_no >= dda->total_steps &&
+                             move_state.seg_tail == move_state.ramp->seg_head))
+       #endif
+      )
     #ifdef ACCELERATION_RAMPING
-      || (move_state.endstop_stop && dda->n <= 0)
+      || (move_state.endstop_stop &&
+          move_state.ramp->step_no > dda->total_steps)
     #endif
       ) {
 		dda->live = 0;
     dda->done = 1;
+    dda_position_add(dda, move_state.position);
+    #ifdef PRESSURE_ADVANCE
+      // Advance left at the end of this move carries over to the next one.
+      if (dda->advance && ! move_state.endstop_stop)
+        move_state.ramp->e_advance += move_state.ramp->e_queued -
+          (dda->e_direction ? (int32_t)dda->delta[E] : -(int32_t)dda->delta[E]);
+      move_state.ramp->e_queued = 0;
+    #endif
     #ifdef LOOKAHEAD
     // If look-ahead was using this move, it could have missed our activation:
     // make sure the ids do not match.
@@ -738,17 +1918,560 @@ void dda_step(DDA *dda) {
 	unstep();
 }
 
+#ifdef ARC_SUPPORT
+/*! Find a point on an arc.
+  \param *dda the arc
+  \param step_no position along the arc, in steps of the path
+  \param *p receives X and Y of the point, in um
+
+  Points in between are found by rotating the start point around the center,
+  start and end point are exact.
+*/
+static void arc_point(DDA *dda, uint32_t step_no, TARGET *p) {
+  if (step_no >= dda->total_steps) {
+    p->axis[X] = dda->endpoint.axis[X];
+    p->axis[Y] = dda->endpoint.axis[Y];
+    return;
+  }
+
+  p->axis[X] = dda->arc_start[X];
+  p->axis[Y] = dda->arc_start[Y];
+  if (step_no)
+    int_rotate(&p->axis[X], &p->axis[Y],
+               muldiv(dda->arc_angle, step_no, dda->total_steps));
+  p->axis[X] += dda->arc_center[X];
+  p->axis[Y] += dda->arc_center[Y];
+}
+
+/*! Calculate the next chord of an arc.
+  \param *dda the arc
+  \param step_no end of the chord along the arc, in steps of the path
+  \param *seg receives the steps and directions of the chord, may be NULL
+  \param pos receives the end of the chord, see move_state.ramp->arc_steps
+
+  The chord starts at move_state.ramp->arc_steps. X and Y work with absolute
+  positions, so rounding errors don't add up, Z and E move in proportion to
+  the path.
+*/
+static void arc_chord(DDA *dda, uint32_t step_no, SEGMENT *seg,
+                      axes_int32_t pos) {
+  TARGET p;
+  axes_uint32_t delta_um;
+  int32_t d;
+  enum axis_e i;
+
+  arc_point(dda, step_no, &p);
+  p.axis[Z] = dda->endpoint.axis[Z];
+  code_axes_to_stepper_axes(&p, &p, delta_um, pos);
+  for (i = Z; i < AXIS_COUNT; i++)
+    pos[i] = muldiv(dda->delta[i], step_no, dda->total_steps);
+
+  if (seg == NULL)
+    return;
+
+  seg->steps = 0;
+  seg->direction = 0;
+  for (i = X; i < AXIS_COUNT; i++) {
+    d = pos[i] - move_state.ramp->arc_steps[i];
+    if (d >= 0)
+      seg->direction |= 1 << i;
+    else
+      d = -d;
+    seg->delta[i] = (uint16_t)d;
+    if (seg->delta[i] > seg->steps)
+      seg->steps = seg->delta[i];
+  }
+  // A chord without steps still takes its time.
+  if (seg->steps == 0)
+    seg->steps = 1;
+}
+#endif /* ARC_SUPPORT */
+
+#ifdef ACCELERATION_RAMPING
+#ifdef ACCELERATION_SCURVE
+/// Scale of step rates in S-curve calculations, rate = SCURVE_RATE / c.
+#define SCURVE_RATE (1UL << 30)
+
+/*! Set up an S-curve acceleration ramp.
+  \param *dda the move
+  \param *ramp RAMP_STATE of the move
+  \param base ramp position at the slow end of this ramp
+  \param len length of this ramp, in steps
+  \param phase 1 = accelerating, 2 = decelerating, 3 = decelerating to a
+         lower cruise speed, see dda_override_live()
+
+  Plain ramps have constant acceleration. On S-curves, acceleration rises
+  linearly from zero to twice the average in the middle of the ramp and
+  falls back to zero at its end, so jerk is constant. Speeds at both ends,
+  length and duration of the ramp are the same as for a plain ramp, so
+  look-ahead and all the other ramp maths don't change.
+
+  Part of fill_segments().
+*/
+static void scurve_start(DDA *dda, RAMP_STATE *ramp, uint32_t base,
+                         uint32_t len, uint8_t phase) {
+  uint32_t slow = 0, fast;
+
+  if (base)
+    slow = SCURVE_RATE / dda_ramp_c(dda, base);
+  fast = SCURVE_RATE / dda_ramp_c(dda, base + len);
+
+  // len steps at the average of both rates.
+  ramp->ramp_duration = muldiv(len, 2 * SCURVE_RATE, slow + fast);
+  ramp->ramp_from = (phase == 1) ? slow : fast;
+  ramp->ramp_to = (phase == 1) ? fast : slow;
+  ramp->ramp_time = 0;
+  ramp->ramp_phase = phase;
+}
+
+/*! Step delay on the current S-curve ramp.
+  \param *dda the move
+  \param *ramp RAMP_STATE of the move
+  \param t time since the start of the ramp, in CPU ticks
+  \return delay until the next step in CPU ticks, within dda->c_min and
+          dda->c0
+
+  Part of fill_segments().
+*/
+static uint32_t scurve_c(DDA *dda, RAMP_STATE *ramp, uint32_t t) {
+  uint32_t tau = 65536, j, rate;
+
+  if (t < ramp->ramp_duration)
+    tau = muldiv(t, 65536, ramp->ramp_duration);
+
+  // Share of the speed change done so far, 2 tau^2 in the first half of
+  // the ramp, 1 - 2 (1 - tau)^2 in the second half. 16.16 fixed point.
+  if (tau < 32768)
+    j = (tau * tau) >> 15;
+  else {
+    tau = 65536 - tau;
+    j = 65536 - ((tau * tau) >> 15);
+  }
+
+  if (ramp->ramp_to > ramp->ramp_from)
+    rate = ramp->ramp_from +
+           muldiv(ramp->ramp_to - ramp->ramp_from, j, 65536);
+  else
+    rate = ramp->ramp_from -
+           muldiv(ramp->ramp_from - ramp->ramp_to, j, 65536);
+
+  if (rate <= SCURVE_RATE / dda->c0)
+    return dda->c0;
+  rate = SCURVE_RATE / rate;
+  return (rate < dda->c_min) ? dda->c_min : rate;
+}
+#endif
+
+/*! Calculate step segments ahead of dda_step().
+
+  \param *dda the current move, or the next one, see dda_prepare()
+  \param *ramp RAMP_STATE of this move
+
+  A segment is a number of steps done at the same step rate, taking about
+  STEP_SEGMENT_TIME. Segments are queued in move_state.segments[] until this
+  queue is full or the whole move is queued. dda_step() takes them from there,
+  so the step interrupt doesn't have to do acceleration maths and step rate
+  changes happen more often than dda_clock() is called.
+
+  For arcs, each segment is a chord of the arc. As chords are expensive, they
+  take TICK_TIME on ramps and are as long as ARC_TOLERANCE allows otherwise.
+
+  Called from dda_clock() with interrupts enabled.
+*/
+static void fill_segments(DDA *dda, RAMP_STATE *ramp) {
+  uint32_t step_no, n, move_c, steps, limit, base = 0;
+  #ifdef ACCELERATION_SCURVE
+    uint32_t step_c;
+  #endif
+  #ifdef PRESSURE_ADVANCE
+    int32_t e = 0;
+  #endif
+  uint8_t head, next, ramping, queued, live, batch;
+  #ifdef ENDSTOP_INTERRUPT
+    uint8_t stop;
+  #endif
+  SEGMENT seg;
+  #ifdef ARC_SUPPORT
+    axes_int32_t pos;
+  #endif
+
+  for (;;) {
+    ATOMIC_START
+      step_no = ramp->step_no;
+      head = ramp->seg_head;
+      next = (head + 1) & (STEP_SEGMENT_BUFFER_SIZE - 1);
+      queued = (next == move_state.seg_tail);
+      #ifdef ENDSTOP_INTERRUPT
+        stop = move_state.endstop_stop;
+      #endif
+    ATOMIC_END
+    if (queued || step_no >= dda->total_steps)
+      break;
+
+    // For maths about stepper speed profiles, see
+    // http://www.embedded.com/design/mcus-processors-and-socs/4006438/Generate-stepper-motor-speed-profiles-in-real-time
+    // and http://www.atmel.com/images/doc8017.pdf (Atmel app note AVR446)
+    //
+    // Find the position on the ramp and where the current phase of the
+    // movement ends. Segments never cross such a phase boundary.
+    // n counts from the start of the rampup or from the end of the
+    // rampdown, base is the ramp position there. After a feed override,
+    // the rampup may start later and decelerate instead, see
+    // dda_override_live().
+    if (ramp->ramp_slow && step_no >= dda->rampup_steps) {
+      // Slowed down, cruise at that speed.
+      dda->c_min = dda_ramp_c(dda, ramp->ramp_base +
+                              ramp->ramp_step - dda->rampup_steps);
+      ramp->ramp_slow = 0;
+    }
+    ramping = 1;
+    if (step_no < dda->rampup_steps) {
+      base = ramp->ramp_base;
+      n = step_no - ramp->ramp_step;
+      limit = dda->rampup_steps;
+      if (ramp->ramp_slow)
+        ramping = 3;
+    }
+    else if (step_no >= dda->rampdown_steps) {
+      #ifdef LOOKAHEAD
+        base = dda->end_steps;
+      #endif
+      n = dda->total_steps - step_no;
+      limit = dda->total_steps;
+      ramping = 2;
+    }
+    else {
+      n = 0;
+      limit = dda->rampdown_steps;
+      ramping = 0;
+    }
+
+    #ifdef ACCELERATION_SCURVE
+      if (ramping) {
+        if (ramping != ramp->ramp_phase) {
+          // At the start of the rampdown, n is its length.
+          if (ramping == 2)
+            scurve_start(dda, ramp, base, n, 2);
+          else if (ramping == 1)
+            scurve_start(dda, ramp, base, limit - ramp->ramp_step, 1);
+          else
+            scurve_start(dda, ramp, base - (limit - ramp->ramp_step),
+                         limit - ramp->ramp_step, 3);
+          // The first step, done by dda_start().
+          if (ramping == 1)
+            ramp->ramp_time = n * dda->c;
+        }
+        move_c = scurve_c(dda, ramp, ramp->ramp_time);
+      }
+      else
+        move_c = dda->c_min;
+    #else
+      if (ramping == 3)
+        move_c = dda_ramp_c(dda, base - n);
+      else
+        move_c = ramping ? dda_ramp_c(dda, base + n) : dda->c_min;
+    #endif
+
+    steps = STEP_SEGMENT_TIME / move_c;
+    #ifdef ARC_SUPPORT
+      if (dda->arc) {
+        steps = ramping ? TICK_TIME / move_c : dda->arc_chord;
+        if (steps > dda->arc_chord)
+          steps = dda->arc_chord;
+      }
+    #endif
+    if (steps == 0)
+      steps = 1;
+    if (steps > limit - step_no)
+      steps = limit - step_no;
+    if (steps > 0xFFFF)
+      steps = 0xFFFF;
+
+    // On ramps, take the step rate from the middle of the segment.
+    #ifdef ACCELERATION_SCURVE
+      if (ramping && steps > 1)
+        move_c = scurve_c(dda, ramp, ramp->ramp_time + (steps * move_c) / 2);
+      step_c = move_c;
+    #else
+      if (ramping == 1 && steps > 1)
+        move_c = dda_ramp_c(dda, base + n + (steps >> 1));
+      else if (ramping == 2 && steps > 1)
+        move_c = dda_ramp_c(dda, base + n - (steps >> 1));
+      else if (ramping == 3 && steps > 1)
+        move_c = dda_ramp_c(dda, base - n - (steps >> 1));
+    #endif
+
+    batch = 1;
+    #ifdef ARC_SUPPORT
+    if (dda->arc) {
+      if (step_no == 0)
+        arc_chord(dda, 0, NULL, ramp->arc_steps);
+      arc_chord(dda, step_no + steps, &seg, pos);
+      // Spread the time of the chord over its step interrupts.
+      move_c = muldiv(move_c, steps, seg.steps);
+    }
+    else
+    #endif
+    {
+      #ifdef STEP_BATCH_RATE
+        // Above STEP_BATCH_RATE, do 2, 4 or 8 steps per step interrupt, as
+        // far as the segment allows.
+        while (batch < 8 && move_c * batch < F_CPU / STEP_BATCH_RATE &&
+               steps >= batch * 2)
+          batch <<= 1;
+        steps &= ~(uint32_t)(batch - 1);
+      #endif
+      seg.steps = (uint16_t)steps;
+    }
+    seg.c = move_c * batch;
+    seg.batch = batch;
+
+    #ifdef PRESSURE_ADVANCE
+      if (dda->advance) {
+        // E steps of the move up to the end of this segment plus advance
+        // for the speed of this segment, minus what's done already. Advance
+        // is K times E speed, which is F_CPU / move_c * delta[E] /
+        // total_steps. Moves ending at standstill end without advance.
+        e = muldiv(dda->delta[E], step_no + steps, dda->total_steps);
+        if ( ! dda->e_direction)
+          e = -e;
+        else if (advance_k && (step_no + steps < dda->total_steps
+                 #ifdef LOOKAHEAD
+                   || dda->end_steps
+                 #endif
+                 ))
+          e += muldiv((int32_t)advance_k * (F_CPU / 1000), dda->delta[E],
+                      dda->total_steps) / (int32_t)move_c;
+        e -= ramp->e_advance + ramp->e_queued;
+
+        // E can't step faster than the fast axis, the rest waits.
+        if (e > (int32_t)steps)
+          e = steps;
+        else if (e < -(int32_t)steps)
+          e = -(int32_t)steps;
+        seg.e_direction = (e >= 0);
+        seg.e_steps = (uint16_t)labs(e);
+      }
+    #endif
+
+    ATOMIC_START
+      // The move might have ended or the step interrupt might have run out
+      // of segments meanwhile. Don't queue anything then. Same for a move
+      // prepared, but started the usual way or re-planned meanwhile.
+      live = (ramp == move_state.ramp) ? dda->live : (dda == prepared);
+      queued = (live && step_no == ramp->step_no);
+      #ifdef ENDSTOP_INTERRUPT
+        // An endstop stop from an interrupt changed the plan.
+        if (stop != move_state.endstop_stop)
+          queued = 0;
+      #endif
+      if (queued) {
+        move_state.segments[head] = seg;
+        ramp->seg_head = next;
+        ramp->step_no = step_no + steps;
+        #ifdef PRESSURE_ADVANCE
+          if (dda->advance)
+            ramp->e_queued += e;
+        #endif
+      }
+    ATOMIC_END
+    if ( ! live)
+      break;
+    #ifdef ACCELERATION_SCURVE
+      if (queued)
+        ramp->ramp_time += steps * step_c;
+    #endif
+    #ifdef ARC_SUPPORT
+      if (queued && dda->arc)
+        memcpy(ramp->arc_steps, pos, sizeof(axes_int32_t));
+    #endif
+  }
+}
+
+/*! Apply a changed feed override to the live move.
+  \param *dda the current move
+  \return bool: done or nothing to do, else try again next time
+
+  Re-plans the rest of the move from the ramp position reached: accelerate
+  to the new cruise speed, or decelerate to it in an extra ramp phase, see
+  fill_segments(). Speed at the end of the move stays, the next move starts
+  with it, so the new cruise speed can't be lower. A move decelerating
+  towards its end already just keeps doing so.
+
+  Part of dda_clock(). Moves not started yet are re-planned by
+  dda_set_feed_override().
+*/
+static uint8_t dda_override_live(DDA *dda) {
+  uint32_t F, step_no, left, n, n_c, n_e = 0, c_min, rampup, rampdown;
+  uint8_t slow = 0, done = 0;
+  RAMP_STATE *ramp = move_state.ramp;
+
+  F = dda_override_F(dda);
+  if (F == dda->endpoint.F)
+    return 1;
+
+  ATOMIC_START
+    step_no = ramp->step_no;
+  ATOMIC_END
+  if (step_no >= dda->rampdown_steps || move_state.endstop_stop) {
+    dda->endpoint.F = F;
+    return 1;
+  }
+
+  // Ramp position reached so far.
+  if (step_no < dda->rampup_steps) {
+    #ifdef ACCELERATION_SCURVE
+    if (ramp->ramp_phase == (ramp->ramp_slow ? 3 : 1))
+      n = dda_ramp_n(dda, scurve_c(dda, move_state.ramp, ramp->ramp_time));
+    else
+    #endif
+    if (ramp->ramp_slow)
+      n = ramp->ramp_base - (step_no - ramp->ramp_step);
+    else
+      n = ramp->ramp_base + (step_no - ramp->ramp_step);
+  }
+  else if (ramp->ramp_slow)
+    n = ramp->ramp_base + ramp->ramp_step - dda->rampup_steps;
+  else
+    n = dda_ramp_n(dda, dda->c_min);
+
+  // Ramp position of the new cruise speed.
+  c_min = dda->move_duration / F;
+  n_c = dda_ramp_n(dda, c_min) + 1;
+  #ifdef LOOKAHEAD
+    n_e = dda->end_steps;
+    if (n_c < n_e) {
+      n_c = n_e;
+      c_min = dda_ramp_c(dda, n_e);
+    }
+  #endif
+
+  left = dda->total_steps - step_no;
+  if (n > n_e + left)
+    n = n_e + left;
+  if (n <= n_c) {
+    rampup = step_no + (n_c - n);
+    rampdown = dda->total_steps - (n_c - n_e);
+    if (rampup > rampdown) {
+      // Cruise speed can't be reached, find the peak speed instead.
+      rampup = step_no + ((n_e + left - n) >> 1);
+      rampdown = rampup;
+    }
+  }
+  else {
+    // Works because n - n_e <= left. c_min gets the new cruise speed at
+    // the end of this ramp, see fill_segments().
+    rampup = step_no + (n - n_c);
+    rampdown = dda->total_steps - (n_c - n_e);
+    c_min = dda_ramp_c(dda, n);
+    slow = 1;
+  }
+
+  ATOMIC_START
+    // Nothing queued meanwhile? dda_step() counts up if it runs out of
+    // segments.
+    if (step_no == ramp->step_no && ! move_state.endstop_stop) {
+      dda->rampup_steps = rampup;
+      dda->rampdown_steps = rampdown;
+      dda->c_min = c_min;
+      dda->endpoint.F = F;
+      ramp->ramp_step = step_no;
+      ramp->ramp_base = n;
+      ramp->ramp_slow = slow;
+      #ifdef ACCELERATION_SCURVE
+        ramp->ramp_phase = 0;
+      #endif
+      done = 1;
+    }
+  ATOMIC_END
+
+  return done;
+}
+
+/*! Queue the first segments of the next move.
+  \param *dda the current move
+
+  As soon as all segments of the current move are queued, those of the move
+  after it get queued behind them, using the RAMP_STATE not in use. When the
+  current move is done, dda_start() just swaps RAMP_STATEs and the step
+  interrupt carries on with these segments right after the first step of
+  the new move. Else the new move would keep the speed of its first step
+  until the next dda_clock(), up to TICK_TIME later.
+
+  Only straight moves following a move which isn't an endstop search get
+  prepared, everything else starts the usual way. Re-planning a prepared
+  move drops what's queued, see dda_unprepare().
+
+  Part of dda_clock().
+*/
+static void dda_prepare(DDA *dda) {
+  DDA *next = NULL;
+  RAMP_STATE *ramp = NULL;
+
+  if (dda->endstop_check)
+    return;
+
+  ATOMIC_START
+    if (dda->live && mb_tail != mb_head &&
+        move_state.ramp->step_no >= dda->total_steps) {
+      next = &movebuffer[(mb_tail + 1) & (MOVEBUFFER_SIZE - 1)];
+      if (next->nullmove || next->waitfor_temp || next->action ||
+          #ifdef ARC_SUPPORT
+            next->arc ||
+          #endif
+          next->endstop_check)
+        next = NULL;
+    }
+    if (next) {
+      ramp = (move_state.ramp == &ramp_state[0]) ?
+             &ramp_state[1] : &ramp_state[0];
+      if (next != prepared) {
+        ramp_state_init(next, ramp, move_state.ramp->seg_head);
+        #ifdef PRESSURE_ADVANCE
+          // Advance left at the end of the current move, as in dda_step().
+          ramp->e_advance = move_state.ramp->e_advance;
+          if (dda->advance)
+            ramp->e_advance += move_state.ramp->e_queued -
+              (dda->e_direction ? (int32_t)dda->delta[E] :
+                                  -(int32_t)dda->delta[E]);
+          ramp->e_queued = 0;
+        #endif
+        prepared = next;
+        prepared_tail = ramp->seg_head;
+      }
+    }
+  ATOMIC_END
+
+  if (next)
+    fill_segments(next, ramp);
+}
+
+/*! Drop the segments queued ahead for a move by dda_prepare().
+  \param *dda the move
+
+  Called with interrupts off when changing the plan of a move not started
+  yet, so it doesn't start with segments of the old plan. The next
+  dda_clock() prepares it anew.
+*/
+void dda_unprepare(DDA *dda) {
+  if (dda == prepared)
+    prepared = NULL;
+}
+#endif
+
 /*! Do regular movement maintenance.
 
   This should be called pretty often, like once every 1 or 2 milliseconds.
 
   Currently, this is checking the endstops and doing acceleration maths. These
   don't need to be checked/recalculated on every single step, so this code
-  can be moved out of the highly time critical dda_step(). At high precision
+  can be moved out of the highly time critical dda_step(). Acceleration
+  results are handed over to dda_step() as step segments, see
+  fill_segments(). At high precision
   (slow) searches of the endstop, this function is called more often than
   dda_step() anyways.
 
-  In the future, arc movement calculations might go here, too. Updating
+  Arcs get split into chords here as well, see fill_segments(). Updating
   movement direction 500 times a second is easily enough for smooth and
   accurate curves!
 */
@@ -756,10 +2479,12 @@ void dda_clock() {
   static volatile uint8_t busy = 0;
   DDA *dda;
   static DDA *last_dda = NULL;
-  uint8_t endstop_trigger = 0;
+  uint8_t endstop_trigger = 0, check, hit;
   #ifdef ACCELERATION_RAMPING
-  uint32_t move_step_no, move_c;
-  uint8_t recalc_speed;
+    // Feed override the live move is planned for, 0 = not checked yet.
+    static uint16_t override = 0;
+    uint16_t new_override;
+    RAMP_STATE *ramp;
   #endif
 
   dda = queue_current_movement();
@@ -768,11 +2493,18 @@ void dda_clock() {
     move_state.debounce_count_z =
     move_state.debounce_count_y = 0;
     last_dda = dda;
+    #ifdef ACCELERATION_RAMPING
+      override = 0;
+    #endif
   }
 
   if (dda == NULL)
     return;
 
+  #ifdef QUEUE_STATISTICS
+    queue_depth[(mb_head - mb_tail) & (MOVEBUFFER_SIZE - 1)]++;
+  #endif
+
   // Lengthy calculations ahead!
   // Make sure we didn't re-enter, then allow nested interrupts.
   if (busy)
@@ -784,188 +2516,188 @@ void dda_clock() {
   //          means, we trust dda isn't changed behind our back, which could
   //          in principle (but rarely) happen if endstops are checked not as
   //          endstop search, but as part of normal operations.
-  if (dda->endstop_check && ! move_state.endstop_stop) {
-    #ifdef X_MIN_PIN
-    if (dda->endstop_check & 0x01) {
-      if (x_min() == dda->endstop_stop_cond)
-        move_state.debounce_count_x++;
-      else
-        move_state.debounce_count_x = 0;
-      endstop_trigger = move_state.debounce_count_x >= ENDSTOP_STEPS;
-    }
+  if (move_state.endstop_check && ! move_state.endstop_stop) {
+    check = move_state.endstop_check;
+    #ifdef ENDSTOP_INTERRUPT
+      // Endstops with a pin change interrupt are handled there.
+      check &= ~endstop_pcint;
     #endif
-    #ifdef X_MAX_PIN
-    if (dda->endstop_check & 0x02) {
-      if (x_max() == dda->endstop_stop_cond)
+    hit = dda_endstops(dda, check);
+
+    // Min and max endstop of an axis share the debounce counter, a move
+    // searches just one of them.
+    if (check & 0x03) {
+      if (hit & 0x03)
         move_state.debounce_count_x++;
       else
         move_state.debounce_count_x = 0;
-      endstop_trigger = move_state.debounce_count_x >= ENDSTOP_STEPS;
+      if (move_state.debounce_count_x >= ENDSTOP_STEPS)
+        endstop_trigger = 1;
     }
-    #endif
-
-    #ifdef Y_MIN_PIN
-    if (dda->endstop_check & 0x04) {
-      if (y_min() == dda->endstop_stop_cond)
-        move_state.debounce_count_y++;
-      else
-        move_state.debounce_count_y = 0;
-      endstop_trigger = move_state.debounce_count_y >= ENDSTOP_STEPS;
-    }
-    #endif
-    #ifdef Y_MAX_PIN
-    if (dda->endstop_check & 0x08) {
-      if (y_max() == dda->endstop_stop_cond)
+    if (check & 0x0C) {
+      if (hit & 0x0C)
         move_state.debounce_count_y++;
       else
         move_state.debounce_count_y = 0;
-      endstop_trigger = move_state.debounce_count_y >= ENDSTOP_STEPS;
+      if (move_state.debounce_count_y >= ENDSTOP_STEPS)
+        endstop_trigger = 1;
     }
-    #endif
-
-    #ifdef Z_MIN_PIN
-    if (dda->endstop_check & 0x10) {
-      if (z_min() == dda->endstop_stop_cond)
-        move_state.debounce_count_z++;
-      else
-        move_state.debounce_count_z = 0;
-      endstop_trigger = move_state.debounce_count_z >= ENDSTOP_STEPS;
-    }
-    #endif
-    #ifdef Z_MAX_PIN
-    if (dda->endstop_check & 0x20) {
-      if (z_max() == dda->endstop_stop_cond)
+    if (check & 0x30) {
+      if (hit & 0x30)
         move_state.debounce_count_z++;
       else
         move_state.debounce_count_z = 0;
-      endstop_trigger = move_state.debounce_count_z >= ENDSTOP_STEPS;
+      if (move_state.debounce_count_z >= ENDSTOP_STEPS)
+        endstop_trigger = 1;
     }
+
+    #ifdef ENDSTOP_INTERRUPT
+      // A trigger pending for a whole tick is past the debounce time in any
+      // case. This covers moves stepping too slowly for dda_step() to check
+      // the 16-bit time stamp.
+      ATOMIC_START
+        if (move_state.endstop_edge == 2)
+          endstop_trigger = 1;
+        else if (move_state.endstop_edge)
+          move_state.endstop_edge = 2;
+      ATOMIC_END
     #endif
 
     // If an endstop is definitely triggered, stop the movement.
-    if (endstop_trigger) {
-      #ifdef ACCELERATION_RAMPING
-        // For always smooth operations, don't halt apruptly,
-        // but start deceleration here.
-        ATOMIC_START
-          move_state.endstop_stop = 1;
-          if (move_state.step_no < dda->rampup_steps)  // still accelerating
-            dda->total_steps = move_state.step_no * 2;
-          else
-            // A "-=" would overflow earlier.
-            dda->total_steps = dda->total_steps - dda->rampdown_steps +
-                               move_state.step_no;
-          dda->rampdown_steps = move_state.step_no;
-        ATOMIC_END
-        // Not atomic, because not used in dda_step().
-        dda->rampup_steps = 0; // in case we're still accelerating
-      #else
-        dda->live = 0;
-      #endif
-
-      endstops_off();
-    }
+    if (endstop_trigger)
+      dda_endstop_stop(dda);
   } /* ! move_state.endstop_stop */
 
   #ifdef ACCELERATION_RAMPING
-    // For maths about stepper speed profiles, see
-    // http://www.embedded.com/design/mcus-processors-and-socs/4006438/Generate-stepper-motor-speed-profiles-in-real-time
-    // and http://www.atmel.com/images/doc8017.pdf (Atmel app note AVR446)
+    // Moves may have started before the queue got re-planned for a new
+    // feed override, so check each of them once.
+    new_override = feed_override;
+    if (new_override != override && dda_override_live(dda))
+      override = new_override;
+
     ATOMIC_START
-      move_step_no = move_state.step_no;
-      // All other variables are read-only or unused in dda_step(),
-      // so no need for atomic operations.
+      ramp = move_state.ramp;
     ATOMIC_END
+    fill_segments(dda, ramp);
+    dda_prepare(dda);
+  #endif
 
-    recalc_speed = 0;
-    if (move_step_no < dda->rampup_steps) {
-      #ifdef LOOKAHEAD
-        dda->n = dda->start_steps + move_step_no;
-      #else
-        dda->n = move_step_no;
-      #endif
-      recalc_speed = 1;
-    }
-    else if (move_step_no >= dda->rampdown_steps) {
-      #ifdef LOOKAHEAD
-        dda->n = dda->total_steps - move_step_no + dda->end_steps;
-      #else
-        dda->n = dda->total_steps - move_step_no;
-      #endif
-      recalc_speed = 1;
-    }
-    if (recalc_speed) {
-      if (dda->n == 0)
-        move_c = pgm_read_dword(&c0_P[dda->fast_axis]);
-      else
-        // Explicit formula: c0 * (sqrt(n + 1) - sqrt(n)),
-        // approximation here: c0 * (1 / (2 * sqrt(n))).
-        // This >> 13 looks odd, but is verified with the explicit formula.
-        move_c = (pgm_read_dword(&c0_P[dda->fast_axis]) *
-                  int_inv_sqrt(dda->n)) >> 13;
-
-      // TODO: most likely this whole check is obsolete. It was left as a
-      //       safety margin, only. Rampup steps calculation should be accurate
-      //       now and give the requested target speed within a few percent.
-      if (move_c < dda->c_min) {
-        // We hit max speed not always exactly.
-        move_c = dda->c_min;
+  cli(); // Compensate sei() above.
+  busy = 0;
+}
 
-        // This is a hack which deals with movements with an unknown number of
-        // acceleration steps. dda_create() sets a very high number, then,
-        // but we don't want to re-calculate all the time.
-        // This hack doesn't work with lookahead.
-        #ifndef LOOKAHEAD
-          dda->rampup_steps = move_step_no;
-          dda->rampdown_steps = dda->total_steps - dda->rampup_steps;
-        #endif
-      }
+/*! Change the feed override.
+  \param percent feed override, in percent of the requested feedrate
 
-      // Write results.
-      ATOMIC_START
-        dda->c = move_c;
-      ATOMIC_END
-    }
+  With ACCELERATION_RAMPING, moves queued already get their cruise speeds
+  re-planned here, the live move within the next dda_clock(). Else only moves
+  created afterwards run at the new speed.
+
+  Called from the main loop, see M220.
+*/
+void dda_set_feed_override(uint16_t percent) {
+  #ifdef LOOKAHEAD
+    uint16_t from = feed_override;
+  #elif defined ACCELERATION_RAMPING
+    uint32_t F, c_min, rampup;
+    uint8_t i;
+    DDA *dda;
   #endif
 
-  cli(); // Compensate sei() above.
-  busy = 0;
+  ATOMIC_START
+    feed_override = percent;
+  ATOMIC_END
+
+  #ifdef LOOKAHEAD
+    dda_override_queue(from);
+  #elif defined ACCELERATION_RAMPING
+    // All moves start and end at standstill, so just the cruise speed and
+    // the ramps towards it change.
+    for (i = mb_tail; ; i = (i + 1) & (MOVEBUFFER_SIZE - 1)) {
+      dda = &movebuffer[i];
+      if ( ! dda->nullmove && ! dda->waitfor_temp) {
+        F = dda_override_F(dda);
+        c_min = dda->move_duration / F;
+        rampup = dda_ramp_n(dda, c_min) + 1;
+        if (rampup > dda->total_steps / 2)
+          rampup = dda->total_steps / 2;
+
+        ATOMIC_START
+          // A move started meanwhile is up to dda_clock().
+          if ( ! dda->live && ! dda->done) {
+            dda->endpoint.F = F;
+            dda->c_min = c_min;
+            dda->rampup_steps = rampup;
+            dda->rampdown_steps = dda->total_steps - rampup;
+            dda_unprepare(dda);
+          }
+        ATOMIC_END
+      }
+      if (i == mb_head)
+        break;
+    }
+  #endif
 }
 
-/// update global current_position struct
+/*! Update global current_position struct.
+
+  X, Y and Z come from the step position counters, see dda_position_add(),
+  so they're exact to the step and accumulate no rounding errors. E is that
+  of the current move, as before.
+*/
 void update_current_position() {
 	DDA *dda = &movebuffer[mb_tail];
-  enum axis_e i;
-
-  // Use smaller values to adjust to avoid overflow in later calculations,
-  // (STEPS_PER_M_X / 1000) is a bit inaccurate for low STEPS_PER_M numbers.
-  static const axes_uint32_t PROGMEM steps_per_mm_P = {
-    ((STEPS_PER_M_X + 500) / 1000),
-    ((STEPS_PER_M_Y + 500) / 1000),
-    ((STEPS_PER_M_Z + 500) / 1000),
-    ((STEPS_PER_M_E + 500) / 1000)
-  };
+  axes_int32_t position;
+  uint32_t e_steps = 0;
+  #ifdef PRESSURE_ADVANCE
+    uint32_t step_no = 0;
+  #endif
+  uint8_t live;
+  enum axis_e i, a = E;
 
 	if (queue_empty()) {
     for (i = X; i < AXIS_COUNT; i++) {
       current_position.axis[i] = startpoint.axis[i];
     }
+    return;
 	}
-	else if (dda->live) {
-    for (i = X; i < AXIS_COUNT; i++) {
-      current_position.axis[i] = dda->endpoint.axis[i] -
-          (int32_t)get_direction(dda, i) *
-          // Should be: move_state.steps[i] * 1000000 / steps_per_m_P[i])
-          // but steps[i] can be like 1000000 already, so we'd overflow.
-          // Unfortunately, using muldiv() overwhelms the compiler.
-          // Also keep the parens around this term, else results go wrong.
-          ((move_state.steps[i] * 1000) / pgm_read_dword(&steps_per_mm_P[i]));
+
+  ATOMIC_START
+    live = dda->live && ! dda->waitfor_temp && ! dda->nullmove;
+    memcpy(position, move_state.position, sizeof(axes_int32_t));
+    if (live) {
+      dda_position_add(dda, position);
+
+      // E is that of the extruder moving, see TARGET.
+      a = TARGET_E_AXIS(&dda->endpoint);
+      e_steps = move_state.steps[a];
+      #ifdef ARC_SUPPORT
+        // For arcs, take the end of the chords queued so far, which is a few
+        // milliseconds ahead, like X and Y.
+        if (dda->arc)
+          e_steps = dda->delta[a] - move_state.ramp->arc_steps[a];
+      #endif
+      #ifdef PRESSURE_ADVANCE
+        step_no = move_state.ramp->step_no;
+      #endif
     }
+  ATOMIC_END
+
+  stepper_axes_to_code_axes(position, &current_position);
 
+  if (live) {
+    #ifdef PRESSURE_ADVANCE
+      // E as if without advance, at the end of the segments queued so far.
+      if (dda->advance)
+        e_steps = dda->delta[a] - muldiv(dda->delta[a], step_no,
+                                         dda->total_steps);
+    #endif
     if (dda->endpoint.e_relative)
-      current_position.axis[E] =
-          (move_state.steps[E] * 1000) / pgm_read_dword(&steps_per_mm_P[E]);
+      current_position.axis[E] = steps_to_um(e_steps, a);
+    else
+      current_position.axis[E] = dda->endpoint.axis[E] -
+          (int32_t)get_direction(dda, a) * steps_to_um(e_steps, a);
+  }
 
-		// current_position.F is updated in dda_start()
-	}
+  // current_position.F is updated in dda_start()
 }
@@ -11,6 +11,83 @@
 	#endif
 #endif
 
+#if defined ARC_SUPPORT && ! defined ACCELERATION_RAMPING
+  #error ARC_SUPPORT works with ACCELERATION_RAMPING only.
+#endif
+
+#if defined ACCELERATION_SCURVE && ! defined ACCELERATION_RAMPING
+  #error ACCELERATION_SCURVE works with ACCELERATION_RAMPING only.
+#endif
+
+#if defined PRESSURE_ADVANCE && ! defined ACCELERATION_RAMPING
+  #error PRESSURE_ADVANCE works with ACCELERATION_RAMPING only.
+#endif
+
+#if defined JUNCTION_DEVIATION && \
+    ( ! defined LOOKAHEAD || ! defined ACCELERATION_RAMPING)
+  #error JUNCTION_DEVIATION works with LOOKAHEAD only.
+#endif
+
+#if defined ENDSTOP_INTERRUPT && ENDSTOP_INTERRUPT > 1000
+  #error ENDSTOP_INTERRUPT, the debounce time, can be 1000 (us) at most.
+#endif
+
+/** \def ACCELERATION_X ACCELERATION_Y ACCELERATION_Z ACCELERATION_E
+  Per-axis acceleration limits, in mm/s^2. Axes not configured explicitly
+  use ACCELERATION.
+*/
+#ifndef ACCELERATION_X
+  #define ACCELERATION_X ACCELERATION
+#endif
+#ifndef ACCELERATION_Y
+  #define ACCELERATION_Y ACCELERATION
+#endif
+#ifndef ACCELERATION_Z
+  #define ACCELERATION_Z ACCELERATION
+#endif
+#ifndef ACCELERATION_E
+  #define ACCELERATION_E ACCELERATION
+#endif
+
+/** \def EXTRUDERS
+  Number of extruder axes, E, E1 and E2, see config.h. Settings of E1 and E2
+  not configured explicitly are the same as those of E.
+*/
+#ifndef EXTRUDERS
+  #define EXTRUDERS 1
+#endif
+#if EXTRUDERS < 1 || EXTRUDERS > 3
+  #error EXTRUDERS can be 1, 2 or 3.
+#endif
+#if EXTRUDERS > 1
+  #ifndef STEPS_PER_M_E1
+    #define STEPS_PER_M_E1 STEPS_PER_M_E
+  #endif
+  #ifndef MAXIMUM_FEEDRATE_E1
+    #define MAXIMUM_FEEDRATE_E1 MAXIMUM_FEEDRATE_E
+  #endif
+  #ifndef ACCELERATION_E1
+    #define ACCELERATION_E1 ACCELERATION_E
+  #endif
+  #ifndef MAX_JERK_E1
+    #define MAX_JERK_E1 MAX_JERK_E
+  #endif
+#endif
+#if EXTRUDERS > 2
+  #ifndef STEPS_PER_M_E2
+    #define STEPS_PER_M_E2 STEPS_PER_M_E
+  #endif
+  #ifndef MAXIMUM_FEEDRATE_E2
+    #define MAXIMUM_FEEDRATE_E2 MAXIMUM_FEEDRATE_E
+  #endif
+  #ifndef ACCELERATION_E2
+    #define ACCELERATION_E2 ACCELERATION_E
+  #endif
+  #ifndef MAX_JERK_E2
+    #define MAX_JERK_E2 MAX_JERK_E
+  #endif
+#endif
+
 #ifndef SIMULATOR
   #include <avr/pgmspace.h>
 #else
@@ -21,8 +98,38 @@
 	types
 */
 
-// Enum to denote an axis
-enum axis_e { X = 0, Y, Z, E, AXIS_COUNT };
+// Enum to denote an axis. E1 and E2 exist with EXTRUDERS only, G-code E
+// moves the extruder of the current tool, see TARGET.
+enum axis_e {
+  X = 0, Y, Z, E,
+  #if EXTRUDERS > 1
+  E1,
+  #endif
+  #if EXTRUDERS > 2
+  E2,
+  #endif
+  AXIS_COUNT
+};
+
+/** \def AXES_XY AXES_XYE AXES_XYZ AXES_Z AXES_E AXES_ALL
+  Axis combinations dda_step() has specialised code for, see dda->axes.
+  Bit n set means axis n moves. AXES_XYE1, AXES_E1 and friends are the same
+  for the other extruders.
+*/
+#define AXES_XY   ((1 << X) | (1 << Y))
+#define AXES_XYE  ((1 << X) | (1 << Y) | (1 << E))
+#define AXES_XYZ  ((1 << X) | (1 << Y) | (1 << Z))
+#define AXES_Z    (1 << Z)
+#define AXES_E    (1 << E)
+#if EXTRUDERS > 1
+  #define AXES_XYE1 ((1 << X) | (1 << Y) | (1 << E1))
+  #define AXES_E1   (1 << E1)
+#endif
+#if EXTRUDERS > 2
+  #define AXES_XYE2 ((1 << X) | (1 << Y) | (1 << E2))
+  #define AXES_E2   (1 << E2)
+#endif
+#define AXES_ALL  ((1 << AXIS_COUNT) - 1)
 
 /**
   \typedef axes_uint32_t
@@ -45,14 +152,141 @@ typedef int32_t axes_int32_t[AXIS_COUNT];
 	\brief target is simply a point in space/time
 
 	X, Y, Z and E are in micrometers unless explcitely stated. F is in mm/min.
+	E is the extruder of the current tool, axis[E1] and axis[E2] are unused.
 */
 typedef struct {
   axes_int32_t axis;
   uint32_t  F;
 
   uint8_t   e_relative        :1; ///< bool: e axis relative? Overrides all_relative
+  #if EXTRUDERS > 1
+  uint8_t   tool              :2; ///< extruder E moves, 0 = E, 1 = E1, ...
+  #endif
 } TARGET;
 
+/** \def TARGET_E_AXIS
+  Extruder axis moved by the E of a target.
+*/
+#if EXTRUDERS > 1
+  #define TARGET_E_AXIS(t) ((enum axis_e)(E + (t)->tool))
+#else
+  #define TARGET_E_AXIS(t) E
+#endif
+
+/**
+  \enum action_e
+  \brief Actions queued in the movement queue, see enqueue_action().
+*/
+enum action_e {
+  ACTION_NONE = 0,
+  ACTION_HEATER,  ///< heater_set(), e.g. a fan, see M106
+  ACTION_TEMP,    ///< temp_set(), see M104, M140
+  ACTION_DWELL,   ///< stand still, see G4
+};
+
+/** \def ACTION_TRANSPARENT
+  Queued action look-ahead joins the moves around, all but a dwell.
+*/
+#define ACTION_TRANSPARENT(dda) \
+  ((dda)->action != ACTION_NONE && (dda)->action != ACTION_DWELL)
+
+#ifdef ACCELERATION_RAMPING
+/** \def STEP_SEGMENT_BUFFER_SIZE
+  Number of step segments queued between dda_clock() and dda_step(). Must be
+  a power of 2 and should cover a bit more than one TICK_TIME.
+*/
+#ifndef STEP_SEGMENT_BUFFER_SIZE
+  #define STEP_SEGMENT_BUFFER_SIZE 8
+#endif
+
+/** \def STEP_SEGMENT_TIME
+  Intended duration of one step segment, in CPU ticks. Shorter segments give
+  smoother acceleration, but need more calculations in dda_clock().
+*/
+#ifndef STEP_SEGMENT_TIME
+  #define STEP_SEGMENT_TIME (TICK_TIME / 4)
+#endif
+
+/**
+  \struct SEGMENT
+  \brief A number of steps done at the same step rate.
+
+  Segments are calculated ahead of time in dda_clock() and taken by
+  dda_step(), so the step interrupt doesn't have to deal with acceleration.
+*/
+typedef struct {
+  uint32_t          c;       ///< time between step interrupts, in CPU ticks
+  uint16_t          steps;   ///< number of steps done at this rate
+  uint8_t           batch;   ///< steps per step interrupt
+  #ifdef ARC_SUPPORT
+  /// For arcs, each segment is a straight chord of the arc. Steps on each
+  /// axis, with 'steps' being the largest of them, and directions.
+  uint16_t          delta[AXIS_COUNT];
+  uint8_t           direction;
+  #endif
+  #ifdef PRESSURE_ADVANCE
+  /// E steps of this segment, including pressure advance, and direction.
+  uint16_t          e_steps;
+  uint8_t           e_direction;
+  #endif
+} SEGMENT;
+
+/** \def ARC_TOLERANCE
+  Maximum deviation of the chords of an arc from the ideal arc, in um. Lower
+  values give more accurate arcs, but need more calculations in dda_clock().
+*/
+#ifndef ARC_TOLERANCE
+  #define ARC_TOLERANCE 5
+#endif
+#else
+  // Step batching is done by the segment queue.
+  #undef STEP_BATCH_RATE
+#endif
+
+#ifdef ACCELERATION_RAMPING
+/**
+  \struct RAMP_STATE
+  \brief Progress of dda_clock() in queuing the segments of a move.
+
+  There are two of these, one for the current move and one for the start of
+  the next move, queued while the current one executes, see dda_prepare().
+  dda_start() just swaps them then.
+*/
+typedef struct {
+  /// Number of steps queued as segments so far. Written by dda_clock(), the
+  /// step interrupt counts up only if it runs out of segments.
+	uint32_t					step_no;
+  /// End of the segments of this move in move_state.segments[].
+  uint8_t           seg_head;
+  /// Written by dda_clock() only: the first ramp of the move starts at step
+  /// ramp_step at ramp position ramp_base. That's the start of the move
+  /// unless a feed override re-planned it, see dda_override_live().
+  uint32_t          ramp_step, ramp_base;
+  /// bool: this ramp decelerates to a lower cruise speed.
+  uint8_t           ramp_slow;
+  #ifdef ACCELERATION_SCURVE
+  /// Written by dda_clock() only: S-curve of the current ramp, see
+  /// scurve_start(). Rates are SCURVE_RATE / c, times in CPU ticks.
+  uint32_t          ramp_from, ramp_to;
+  uint32_t          ramp_duration, ramp_time;
+  /// 1 = rampup, 2 = rampdown, 3 = slowing down, 0 = none yet
+  uint8_t           ramp_phase;
+  #endif
+  #ifdef PRESSURE_ADVANCE
+  /// Written by dda_clock() only: E steps queued in this move, including
+  /// pressure advance, in machine direction.
+  int32_t           e_queued;
+  /// Pressure advance at the start of this move, in E steps.
+  int32_t           e_advance;
+  #endif
+  #ifdef ARC_SUPPORT
+  /// Written by dda_clock() only: end of the last chord queued. X and Y are
+  /// absolute positions, Z and E steps done since the start of the arc.
+  axes_int32_t      arc_steps;
+  #endif
+} RAMP_STATE;
+#endif
+
 /**
 	\struct MOVE_STATE
 	\brief this struct is made for tracking the current state of the movement
@@ -65,11 +299,35 @@ typedef struct {
 
 	// step counters
   axes_uint32_t     steps;   ///< number of steps on each axis
+  /// Position of each motor in steps, as of the start of the current move,
+  /// counting from the origin of startpoint_steps. Updated at the end of
+  /// each move, see dda_position_add(). E isn't counted here.
+  axes_int32_t      position;
 
 	#ifdef ACCELERATION_RAMPING
-	/// counts actual steps done
-	uint32_t					step_no;
+  /// Steps left in the segment currently executed by dda_step().
+  uint16_t          seg_steps;
+  /// Steps per step interrupt in this segment, see STEP_BATCH_RATE.
+  uint8_t           batch;
+  /// Segment queue, written by dda_clock() at ramp->seg_head, read by
+  /// dda_step() at seg_tail.
+  SEGMENT           segments[STEP_SEGMENT_BUFFER_SIZE];
+  uint8_t           seg_tail;
+  /// Where dda_clock() is with the current move, one of two RAMP_STATEs.
+  RAMP_STATE        *ramp;
 	#endif
+  #ifdef PRESSURE_ADVANCE
+  /// E steps of the current segment and its step interrupts, see
+  /// dda_advance_start(). Remaining steps and counter are in steps[E] and
+  /// counter[E].
+  uint16_t          e_delta, e_total;
+  #endif
+  #ifdef ARC_SUPPORT
+  /// Steps on each axis and the step interrupts of the arc chord currently
+  /// executed, used instead of dda->delta[] and dda->total_steps for arcs.
+  axes_uint32_t     chord_delta;
+  uint32_t          chord_total;
+  #endif
 	#ifdef ACCELERATION_TEMPORAL
   axes_uint32_t     time;       ///< time of the last step on each axis
   uint32_t          last_time;  ///< time of the last step of any axis
@@ -77,7 +335,16 @@ typedef struct {
 
 	/// Endstop handling.
   uint8_t endstop_stop; ///< Stop due to endstop trigger
+  /// Endstops checked, dda->endstop_check without those triggered at the
+  /// start of the move, see dda_start().
+  uint8_t endstop_check;
   uint8_t debounce_count_x, debounce_count_y, debounce_count_z;
+  #ifdef ENDSTOP_INTERRUPT
+  /// Endstop trigger seen by the pin change interrupt and not yet debounced,
+  /// see dda_endstop_edge(). 1 = pending, 2 = pending for a whole tick.
+  uint8_t endstop_edge;
+  uint16_t endstop_edge_time; ///< TCNT1 at this endstop trigger
+  #endif
 } MOVE_STATE;
 
 /**
@@ -86,11 +353,14 @@ typedef struct {
 
 	This struct holds all the details of an individual multi-axis move, including pre-calculated acceleration data.
 	This struct is filled in by dda_create(), called from enqueue(), called mostly from gcode_process() and from a few other places too (eg \file homing.c)
+
+	Fields used while the move runs, by dda_step() and fill_segments(), come
+	first. AVR reaches only the first 64 bytes of a struct with a single
+	displacement load (LDD), everything further away costs extra pointer
+	arithmetic in the step interrupt. Fields used for planning only, like the
+	endpoint and the look-ahead junction data, go to the end.
 */
 typedef struct {
-	/// this is where we should finish
-	TARGET						endpoint;
-
 	union {
 		struct {
 			// status fields
@@ -103,6 +373,20 @@ typedef struct {
 
 			// wait for temperature to stabilise flag
 			uint8_t						waitfor_temp	:1; ///< bool: wait for temperatures to reach their set values
+      uint8_t           set_position  :1; ///< bool: no move, endpoint holds new step positions, see enqueue_position()
+
+      #ifdef LOOKAHEAD
+      uint8_t           optimal       :1; ///< bool: entry speed can't be raised any further by look-ahead
+      #endif
+      #ifdef ARC_SUPPORT
+      uint8_t           arc           :1; ///< bool: this is an arc, see G2, G3
+      #endif
+      #ifdef PRESSURE_ADVANCE
+      uint8_t           advance       :1; ///< bool: E steps come from segments
+      #endif
+      /// Endstop condition on which to stop motion: 0=Stop on detrigger,
+      /// 1=Stop on trigger, see endstop_check.
+      uint8_t           endstop_stop_cond :1;
 
 			// directions
       // As we have muldiv() now, overflows became much less an issue and
@@ -112,6 +396,12 @@ typedef struct {
 			uint8_t						y_direction		:1; ///< direction flag for Y axis
 			uint8_t						z_direction		:1; ///< direction flag for Z axis
 			uint8_t						e_direction		:1; ///< direction flag for E axis
+      #if EXTRUDERS > 1
+      uint8_t           e1_direction  :1; ///< direction flag for E1 axis
+      #endif
+      #if EXTRUDERS > 2
+      uint8_t           e2_direction  :1; ///< direction flag for E2 axis
+      #endif
 		};
     uint16_t            allflags; ///< used for clearing all flags
 	};
@@ -121,40 +411,27 @@ typedef struct {
 
   // uint8_t        fast_axis;   (see below)
   uint32_t          total_steps; ///< steps of the "fast" axis
-  uint32_t          fast_um;     ///< movement length of this fast axis
-  uint32_t          fast_spm;    ///< steps per meter of the fast axis
 
 	uint32_t					c; ///< time until next step, 24.8 fixed point
 
 	#ifdef ACCELERATION_REPRAP
 	uint32_t					end_c; ///< time between 2nd last step and last step
-	#endif
-	#ifdef ACCELERATION_RAMPING
   /// precalculated step time offset variable
   int32_t           n;
+	#endif
+	#ifdef ACCELERATION_RAMPING
 	/// number of steps accelerating
 	uint32_t					rampup_steps;
 	/// number of last step before decelerating
 	uint32_t					rampdown_steps;
 	/// 24.8 fixed point timer value, maximum speed
 	uint32_t					c_min;
+  /// timer value of the first step, depends on the acceleration of this move
+  uint32_t          c0;
   #ifdef LOOKAHEAD
-  // With the look-ahead functionality, it is possible to retain physical
-  // movement between G1 moves. These variables keep track of the entry and
-  // exit speeds between moves.
-  uint32_t          distance;
-  uint32_t          crossF;
   // These two are based on the "fast" axis, the axis with the most steps.
   uint32_t          start_steps; ///< would be required to reach start feedrate
   uint32_t          end_steps; ///< would be required to stop from end feedrate
-  // Displacement vector, in um, based between the difference of the starting
-  // point and the target. Required to obtain the jerk between 2 moves.
-  // Note: x_delta and co are in steps, not um.
-  axes_int32_t      delta_um;
-  // Number the moves to be able to test at the end of lookahead if the moves
-  // are the same. Note: we do not need a lot of granularity here: more than
-  // MOVEBUFFER_SIZE is already enough.
-  uint8_t           id;
   #endif
 	#endif
 	#ifdef ACCELERATION_TEMPORAL
@@ -167,10 +444,74 @@ typedef struct {
   /// so keep small variables grouped together to reduce the amount of these
   /// gaps. See e.g. NXP application note AN10963, page 10f.
   uint8_t           fast_axis;       ///< number of the fast axis
+  /// Axes moving, one of the AXES_* combinations. Picks the dda_step()
+  /// variant, which skips axes not in there.
+  uint8_t           axes;
+  #ifdef ARC_SUPPORT
+  /// Longest arc chord staying within ARC_TOLERANCE, in steps of the path.
+  uint16_t          arc_chord;
+  #endif
 
 	/// Endstop homing
-	uint8_t endstop_check; ///< Do we need to check endstops? 0x1=Check X, 0x2=Check Y, 0x4=Check Z
-	uint8_t endstop_stop_cond; ///< Endstop condition on which to stop motion: 0=Stop on detrigger, 1=Stop on trigger
+	/// Endstops to check: 0x01 = X min, 0x02 = X max, 0x04 = Y min,
+	/// 0x08 = Y max, 0x10 = Z min, 0x20 = Z max
+	uint8_t endstop_check;
+
+  /// Queued action, one of enum action_e, see enqueue_action(). Entries
+  /// with an action are nullmoves.
+  uint8_t           action;
+
+	/// this is where we should finish
+	TARGET						endpoint;
+
+  union {
+    /// Movement length of the fast axis, for moves.
+    uint32_t        fast_um;
+    /// Heater or temperature sensor and value to set, dwell time in ms, for
+    /// actions. These are nullmoves, which never use fast_um.
+    struct {
+      uint8_t       action_index;
+      uint16_t      action_value;
+    };
+  };
+
+  #ifdef ACCELERATION_RAMPING
+  /// c_min times endpoint.F, see dda_create(). Allows to find c_min for
+  /// another feedrate, see dda_override_F().
+  uint32_t          move_duration;
+  #ifdef LOOKAHEAD
+  // With the look-ahead functionality, it is possible to retain physical
+  // movement between G1 moves. These variables keep track of the entry and
+  // exit speeds between moves.
+  uint32_t          distance;
+  uint32_t          max_entry; ///< would be required to reach crossF
+  // Unit vector along the move, scaled by 2^14, see dda_unit_vector().
+  // Times a feedrate this is the speed of each axis, required to obtain the
+  // jerk between 2 moves.
+  int16_t           unit[AXIS_COUNT];
+  /// Feedrate at the corner to the move before, in mm/min. A feedrate, like
+  /// F_nominal and F_max.
+  uint16_t          crossF;
+  #endif
+  /// Acceleration of this move, relative to the limit of the fast axis.
+  /// 4096 = 1.0, lower if another axis limits acceleration.
+  uint16_t          accel_scale;
+  /// Feedrate as requested, without feed override, and the highest feedrate
+  /// the axes allow for this move, both in mm/min. See dda_override_F().
+  uint16_t          F_nominal, F_max;
+  #ifdef LOOKAHEAD
+  // Number the moves to be able to test at the end of lookahead if the moves
+  // are the same. Note: we do not need a lot of granularity here: more than
+  // MOVEBUFFER_SIZE is already enough.
+  uint8_t           id;
+  #endif
+  #endif
+  #ifdef ARC_SUPPORT
+  /// Arc movement, in the XY plane. Z and E move linearly along the arc.
+  int32_t           arc_center[2];   ///< center of the arc, in um
+  int32_t           arc_start[2];    ///< start point relative to the center
+  int32_t           arc_angle;       ///< radians * 2^28, positive = CCW
+  #endif
 } DDA;
 
 /*
@@ -183,6 +524,22 @@ extern TARGET startpoint;
 /// the same as above, counted in motor steps
 extern TARGET startpoint_steps;
 
+#ifdef PRESSURE_ADVANCE
+/// pressure advance factor K, in milliseconds, see M233
+extern uint16_t advance_k;
+#endif
+
+/// feed override, in percent of the requested feedrate, see M220
+extern uint16_t feed_override;
+
+/// flow override, in percent of the requested E distance, see M221
+extern uint16_t flow_override;
+
+#ifdef JUNCTION_DEVIATION
+/// maximum allowed acceleration on each axis, in mm/s^2 * 16
+extern const axes_uint32_t PROGMEM acceleration_P;
+#endif
+
 /// current_position holds the machine's current position. this is only updated when we step, or when G92 (set home) is received.
 extern TARGET current_position;
 
@@ -208,6 +565,23 @@ void dda_step(DDA *dda);
 // regular movement maintenance
 void dda_clock(void);
 
+// change the feed override, also for moves already queued
+void dda_set_feed_override(uint16_t percent);
+
+#ifdef ACCELERATION_RAMPING
+// step delay for a given position on the acceleration ramp
+uint32_t dda_ramp_c(DDA *dda, uint32_t n);
+
+// acceleration ramp length of a move for a given fast axis feedrate
+uint32_t dda_ramp_len(DDA *dda, uint32_t feedrate);
+
+// feedrate of a move at the current feed override
+uint32_t dda_override_F(DDA *dda);
+
+// forget the segments queued ahead for a move getting re-planned
+void dda_unprepare(DDA *dda);
+#endif
+
 // update current_position
 void update_current_position(void);
 
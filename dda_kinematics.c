@@ -34,3 +34,20 @@ carthesian_to_corexy(TARGET *startpoint, TARGET *target,
   delta_um[Z] = (uint32_t)labs(target->axis[Z] - startpoint->axis[Z]);
   steps[Z] = um_to_steps(target->axis[Z], Z);
 }
+
+void
+steps_to_carthesian(axes_int32_t steps, TARGET *pos) {
+  enum axis_e i;
+
+  for (i = X; i < E; i++)
+    pos->axis[i] = steps_to_um(steps[i], i);
+}
+
+void
+corexy_steps_to_carthesian(axes_int32_t steps, TARGET *pos) {
+  int32_t a = steps_to_um(steps[X], X), b = steps_to_um(steps[Y], Y);
+
+  pos->axis[X] = (a + b) / 2;
+  pos->axis[Y] = (a - b) / 2;
+  pos->axis[Z] = steps_to_um(steps[Z], Z);
+}
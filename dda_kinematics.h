@@ -21,6 +21,10 @@ void carthesian_to_corexy(TARGET *startpoint, TARGET *target,
 //void carthesian_to_scara(TARGET *startpoint, TARGET *target,
 //                         axes_uint32_t delta_um, axes_int32_t steps);
 
+void steps_to_carthesian(axes_int32_t steps, TARGET *pos);
+
+void corexy_steps_to_carthesian(axes_int32_t steps, TARGET *pos);
+
 static void code_axes_to_stepper_axes(TARGET *, TARGET *, axes_uint32_t,
                                       axes_int32_t)
                                       __attribute__ ((always_inline));
@@ -38,4 +42,18 @@ inline void code_axes_to_stepper_axes(TARGET *startpoint, TARGET *target,
   #endif
 }
 
+/*! The reverse: motor positions, in steps, to X, Y and Z, in um.
+  \param steps position of each motor
+  \param *pos receives X, Y and Z, E is left alone
+*/
+static void stepper_axes_to_code_axes(axes_int32_t, TARGET *)
+                                      __attribute__ ((always_inline));
+inline void stepper_axes_to_code_axes(axes_int32_t steps, TARGET *pos) {
+  #if KINEMATICS == KINEMATICS_STRAIGHT
+    steps_to_carthesian(steps, pos);
+  #elif KINEMATICS == KINEMATICS_COREXY
+    corexy_steps_to_carthesian(steps, pos);
+  #endif
+}
+
 #endif /* _DDA_KINEMATICS_H */
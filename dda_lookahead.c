@@ -32,6 +32,14 @@ extern uint8_t use_lookahead;
 
 uint32_t lookahead_joined = 0;      // Total number of moves joined together
 uint32_t lookahead_timeout = 0;     // Moves that did not compute in time to be actually joined
+#ifdef QUEUE_STATISTICS
+// Crossing speeds of the moves joined: sum and number of them, for the
+// average, and the lowest one. Sum and number get halved before the sum
+// overflows, so old moves count less.
+uint32_t lookahead_crossF_sum = 0;
+uint32_t lookahead_crossF_n = 0;
+uint32_t lookahead_crossF_min = 0xFFFFFFFF;
+#endif
 
 // Used for look-ahead debugging
 #ifdef LOOKAHEAD_DEBUG_VERBOSE
@@ -46,28 +54,16 @@ static const axes_uint32_t PROGMEM maximum_jerk_P = {
   MAX_JERK_X,
   MAX_JERK_Y,
   MAX_JERK_Z,
-  MAX_JERK_E
+  MAX_JERK_E,
+  #if EXTRUDERS > 1
+  MAX_JERK_E1,
+  #endif
+  #if EXTRUDERS > 2
+  MAX_JERK_E2,
+  #endif
 };
 
 
-// We also need the inverse: given a ramp length, determine the expected speed
-// Note: the calculation is scaled by a factor 16384 to obtain an answer with a smaller
-// rounding error.
-// Warning: this is an expensive function as it requires a square root to get the result.
-//
-uint32_t dda_steps_to_velocity(uint32_t steps) {
-  // v(t) = a*t, with v in mm/s and a = acceleration in mm/s²
-  // s(t) = 1/2*a*t² with s (displacement) in mm
-  // Rewriting yields v(s) = sqrt(2*a*s)
-  // Rewriting into steps and seperation in constant part and dynamic part:
-  // F_steps = sqrt((2000*a)/STEPS_PER_M_X) * 60 * sqrt(steps)
-  static uint32_t part = 0;
-  if(part == 0)
-    part = (uint32_t)sqrtf((2000.0f*3600.0f*ACCELERATION*16384.0f)/(float)STEPS_PER_M_X);
-  uint32_t res = int_sqrt((steps) << 14) * part;
-  return res >> 14;
-}
-
 /**
  * Determine the 'jerk' between 2 2D vectors and their speeds. The jerk can be
  * used to obtain an acceptable speed for changing directions between moves.
@@ -160,6 +156,85 @@ void dda_emergency_shutdown(PGM_P msg_P) {
   for (;;) { }
 }
 
+#ifdef JUNCTION_DEVIATION
+/**
+ * \brief Corner speed from the junction deviation model.
+ * \details Instead of looking at the speed change of each axis, think of
+ * the corner as rounded off by a circle which passes JUNCTION_DEVIATION away
+ * from the corner point and touches both moves. The corner speed is the one
+ * at which the centripetal acceleration on this circle matches the
+ * acceleration of the moves:
+ *
+ *                           sin(theta / 2)
+ *   v^2 = a * deviation * ------------------
+ *                         1 - sin(theta / 2)
+ *
+ * with theta being 180 degrees minus the direction change, so
+ * sin(theta / 2) = sqrt((1 + cos(change)) / 2). cos(change) is the dot
+ * product of the unit vectors of both moves, which dda_create() prepared.
+ * This is the cornering algorithm of Grbl. Shallow angles pass almost at
+ * full speed, regardless of the axes involved.
+ *
+ * E has no corners, it still has to stay within MAX_JERK_E.
+ *
+ * \param [in] prev is the DDA structure of the move previous to the current one.
+ * \param [in] current is the DDA structure of the move currently created.
+ * \param [in] F is the lower of both feedrates, in mm/min.
+ *
+ * \return Corner speed, in mm/min.
+ */
+static uint32_t dda_junction_speed(DDA *prev, DDA *current, uint32_t F) {
+  int32_t cos_change = 0;
+  uint32_t du, jerk, s, d, a, k;
+  enum axis_e i;
+
+  // Keeps F * F below 2^31 for muldiv().
+  if (F > 46340)
+    F = 46340;
+
+  for (i = E; i < AXIS_COUNT; i++) {
+    du = labs((int32_t)prev->unit[i] - current->unit[i]);
+    jerk = pgm_read_dword(&maximum_jerk_P[i]);
+    if (((du * F) >> 14) > jerk)
+      F = (jerk << 14) / du;
+  }
+
+  for (i = X; i < AXIS_COUNT; i++)
+    cos_change += (int32_t)prev->unit[i] * current->unit[i];
+
+  if (cos_change >= ((int32_t)1 << 28))
+    return F;
+  if (cos_change <= -((int32_t)1 << 28))
+    return 0;
+
+  // sin(theta / 2), scaled by 2^14.
+  s = int_sqrt((uint32_t)(((int32_t)1 << 28) + cos_change) >> 1);
+  if (s >= ((uint32_t)1 << 14))
+    return F;
+  d = ((uint32_t)1 << 14) - s;
+
+  // Acceleration of the weaker move, in mm/s^2 * 16. Acceleration along the
+  // move is at least the one of its fast axis.
+  a = (pgm_read_dword(&acceleration_P[prev->fast_axis]) *
+       prev->accel_scale) >> 12;
+  k = (pgm_read_dword(&acceleration_P[current->fast_axis]) *
+       current->accel_scale) >> 12;
+  if (k < a)
+    a = k;
+
+  // a * deviation in (mm/min)^2, 3600 converts from seconds.
+  k = (a * (uint32_t)(JUNCTION_DEVIATION * 3600.)) >> 4;
+
+  // For small direction changes, s / d gets big, avoid the overflow.
+  if (s >= d && (uint32_t)muldiv(F * F, d, s) <= k)
+    return F;
+
+  // Sharp corners have s < d, but the model knows nothing about the
+  // feedrates or the E jerk limit, both in F already.
+  return MIN(F, int_sqrt(muldiv(k, s, d)));
+}
+#endif /* JUNCTION_DEVIATION */
+
 /**
  * \brief Find maximum corner speed between two moves.
  * \details Find out how fast we can move around around a corner without
@@ -174,9 +249,7 @@ void dda_emergency_shutdown(PGM_P msg_P) {
  * \return dda->crossF
  */
 void dda_find_crossing_speed(DDA *prev, DDA *current) {
-  uint32_t F, dv, speed_factor, max_speed_factor;
-  axes_int32_t prevF, currF;
-  enum axis_e i;
+  uint32_t F;
 
   // Bail out if there's nothing to join (e.g. G1 F1500).
   if ( ! prev || prev->nullmove)
@@ -192,16 +265,22 @@ void dda_find_crossing_speed(DDA *prev, DDA *current) {
     sersendf_P(PSTR("Distance: %lu, then %lu\n"),
                prev->distance, current->distance);
 
-  // Find individual axis speeds.
-  // TODO: this is eight expensive muldiv()s. It should be possible to store
-  //       currF as prevF for the next calculation somehow, to save 4 of
-  //       these 8 muldiv()s. This would also allow to get rid of
-  //       dda->delta_um[] and using delta_um[] from dda_create() instead.
-  //       Caveat: bail out condition above and some other non-continuous
-  //               situations might need some extra code for handling.
+  #ifdef JUNCTION_DEVIATION
+    current->crossF = dda_junction_speed(prev, current, F);
+
+    if (DEBUG_DDA && (debug_flags & DEBUG_DDA))
+      sersendf_P(PSTR("Junction speed from %lu to %u\n"),
+                 F, current->crossF);
+  #else
+  uint32_t dv, speed_factor, max_speed_factor;
+  axes_int32_t prevF, currF;
+  enum axis_e i;
+
+  // Find individual axis speeds. The unit vectors come from dda_create(),
+  // so this takes no divisions.
   for (i = X; i < AXIS_COUNT; i++) {
-    prevF[i] = muldiv(prev->delta_um[i], F, prev->distance);
-    currF[i] = muldiv(current->delta_um[i], F, current->distance);
+    prevF[i] = ((int32_t)prev->unit[i] * (int32_t)F) >> 14;
+    currF[i] = ((int32_t)current->unit[i] * (int32_t)F) >> 14;
   }
 
   if (DEBUG_DDA && (debug_flags & DEBUG_DDA))
@@ -251,52 +330,189 @@ void dda_find_crossing_speed(DDA *prev, DDA *current) {
     current->crossF = (F * max_speed_factor) >> 8;
 
   if (DEBUG_DDA && (debug_flags & DEBUG_DDA))
-    sersendf_P(PSTR("Cross speed reduction from %lu to %lu\n"),
+    sersendf_P(PSTR("Cross speed reduction from %lu to %u\n"),
                F, current->crossF);
+  #endif /* JUNCTION_DEVIATION */
+}
 
-  return;
+/**
+ * \brief Ratio between fast axis movement and movement distance.
+ *
+ * \param [in] dda is the DDA structure of the move to look at.
+ *
+ * \return fast_um / distance, scaled by 4096.
+ */
+static uint32_t dda_fast_ratio(DDA *dda) {
+  return muldiv(dda->fast_um, 4096, dda->distance);
 }
 
 /**
- * \brief Join 2 moves by removing the full stop between them, where possible.
+ * \brief Convert a ramp position from one move to another one.
+ * \details Ramp positions (start_steps, end_steps, ...) are counted in
+ * steps of the fast axis of the move they belong to. To find the position on
+ * the ramp of a neighbouring move matching the same speed along the movement
+ * direction, it has to be scaled by the square of the fast axis speed ratio
+ * (ramp length goes with the square of the speed) and by the ratio of the
+ * ramp divisors (steps/m and acceleration of both fast axes, see
+ * acc_ramp_len()) as well as the acceleration of both moves.
+ *
+ * \param [in] n is the position on the ramp of 'from', in steps.
+ * \param [in] from is the DDA structure n belongs to.
+ * \param [in] to is the DDA structure to find the ramp position for.
+ *
+ * \return Position on the ramp of 'to', in steps.
+ */
+static uint32_t dda_ramp_convert(uint32_t n, DDA *from, DDA *to) {
+  uint32_t ratio_from = dda_fast_ratio(from);
+  uint32_t ratio_to = dda_fast_ratio(to);
+
+  if (n == 0)
+    return 0;
+
+  if (ratio_from != ratio_to) {
+    n = muldiv(n, ratio_to, ratio_from);
+    n = muldiv(n, ratio_to, ratio_from);
+  }
+  if (from->fast_axis != to->fast_axis)
+    n = muldiv(n, pgm_read_dword(&acc_ramp_div_P[from->fast_axis]),
+               pgm_read_dword(&acc_ramp_div_P[to->fast_axis]));
+  if (from->accel_scale != to->accel_scale)
+    n = muldiv(n, from->accel_scale, to->accel_scale);
+
+  return n;
+}
+
+/**
+ * \brief Ramp length for a given speed along the movement direction.
+ *
+ * \param [in] dda is the DDA structure of the move.
+ * \param [in] F is the speed along the movement direction, in mm/min.
+ *
+ * \return Steps on the fast axis needed to accelerate from standstill to F.
+ */
+static uint32_t dda_ramp_steps(DDA *dda, uint32_t F) {
+  return dda_ramp_len(dda, muldiv(dda->fast_um, F, dda->distance));
+}
+
+/**
+ * \brief Build the ramps of a move between given entry and exit speeds.
+ *
+ * \param [in] dda is the DDA structure of the move.
+ * \param [in] F is its cruising speed, in mm/min.
+ * \param [in] entry is the ramp position at the start of the move.
+ * \param [in] exit is the ramp position at its end.
+ * \param [out] rampup gets the number of steps accelerating.
+ * \param [out] rampdown gets the number of the last step before decelerating.
+ */
+static void dda_ramps(DDA *dda, uint32_t F, uint32_t entry, uint32_t exit,
+                      uint32_t *rampup, uint32_t *rampdown) {
+  uint32_t F_in_steps, up, down;
+
+  // Cruising speed in steps.
+  F_in_steps = dda_ramp_steps(dda, F);
+  if (entry > F_in_steps)
+    F_in_steps = entry;
+  if (exit > F_in_steps)
+    F_in_steps = exit;
+
+  up = F_in_steps - entry;
+  down = F_in_steps - exit;
+  if (up + down > dda->total_steps) {
+    // Cruising speed can't be reached, find the peak speed instead.
+    // Works because |entry - exit| <= total_steps.
+    up = (dda->total_steps + exit - entry) >> 1;
+    down = dda->total_steps - up;
+  }
+  *rampup = up;
+  *rampdown = dda->total_steps - down;
+}
+
+/**
+ * \brief Find the move before another one in the queue.
+ * \details Queued actions in between get skipped, look-ahead joins the moves
+ * around them, see ACTION_TRANSPARENT. Done actions aren't skipped, the move
+ * before them is done or live already.
+ *
+ * \param [in] i is the index of the move in movebuffer[].
+ * \param [in] last is the index to stop at.
+ *
+ * \return index of the entry before, which is a move, or not a transparent
+ * action, or last.
+ */
+static uint8_t dda_prev_move(uint8_t i, uint8_t last) {
+  do
+    i = (i - 1) & (MOVEBUFFER_SIZE - 1);
+  while (i != last && ACTION_TRANSPARENT(&movebuffer[i]) &&
+         ! movebuffer[i].done);
+
+  return i;
+}
+
+/**
+ * \brief Find the move after another one in the queue, the reverse of
+ * dda_prev_move().
+ */
+static uint8_t dda_next_move(uint8_t i, uint8_t last) {
+  do
+    i = (i + 1) & (MOVEBUFFER_SIZE - 1);
+  while (i != last && ACTION_TRANSPARENT(&movebuffer[i]));
+
+  return i;
+}
+
+/**
+ * \brief Join moves by removing the full stop between them, where possible.
  * \details To join the moves, the deceleration ramp of the previous move and
  * the acceleration ramp of the current move are shortened, resulting in a
  * non-zero speed at that point. The target speed at the corner is already to
- * be found in dda->crossF. See dda_find_corner_speed().
+ * be found in dda->crossF. See dda_find_crossing_speed().
+ *
+ * Short moves often can't reach the corner speed within their own length,
+ * because the planner always makes sure the movement can be stopped within
+ * the last move (= 'current'). Accordingly, appending a move can allow higher
+ * speeds for a number of moves before it, too. This is dealt with in two
+ * passes over the movement queue:
+ *
+ *   1. Reverse pass, starting at 'current' and walking towards mb_tail: find
+ *      the highest entry speed of each move which still allows to decelerate
+ *      to the (maximum) entry speed of its successor. The pass stops early at
+ *      a move marked 'optimal', at a move whose entry speed doesn't rise any
+ *      further or at a move already executing.
+ *
+ *   2. Forward pass, walking back from there to 'current': limit each exit
+ *      speed to what can be reached by accelerating from the entry speed and
+ *      calculate the ramps of each move accordingly.
  *
- * Ideally, both ramps can be reduced to actually have Fcorner at the corner,
- * but the surrounding movements might no be long enough to achieve this speed.
- * Analysing both moves to find the best result is done here.
+ * Moves before the one the reverse pass stopped at stay untouched, so the
+ * work done per appended move is bounded by how far speeds actually change,
+ * not by MOVEBUFFER_SIZE. dda->max_entry keeps the entry speed allowed by
+ * each corner, dda->optimal marks moves already entered at this speed.
+ * New ramps get written only after all of them are known, see below.
  *
- * TODO: to achieve better results with short moves (move distance < both ramps),
- *       this function should be able to enhance the corner speed on repeated
- *       calls when reverse-stepping through the movement queue.
+ * All speeds here are ramp positions in steps of the fast axis of the move
+ * they belong to, like dda->start_steps. Converting between moves is done with
+ * dda_ramp_convert(). With ACCELERATION_SCURVE, fill_segments() shapes the
+ * ramps between these speeds, the speeds at their ends stay the same.
  *
  * \param [in] prev is the DDA structure of the move previous to the current one.
  * \param [in] current is the DDA structure of the move currently created.
  *
  * Premise: the 'current' move is not dispatched in the queue: it should remain
  * constant while this function is running.
- *
- * Note: the planner always makes sure the movement can be stopped within the
- * last move (= 'current'); as a result a lot of small moves will still limit the speed.
  */
 void dda_join_moves(DDA *prev, DDA *current) {
-
-  // Calculating the look-ahead settings can take a while; before modifying
-  // the previous move, we need to locally store any values and write them
-  // when we are done (and the previous move is not already active).
-  uint32_t prev_F, prev_F_in_steps, prev_F_start_in_steps, prev_F_end_in_steps;
-  uint32_t prev_rampup, prev_rampdown, prev_total_steps;
-  uint32_t crossF, crossF_in_steps;
-  uint8_t prev_id;
-  // Similarly, we only want to modify the current move if we have the results of the calculations;
-  // until then, we do not want to touch the current move settings.
-  // Note: we assume 'current' will not be dispatched while this function runs, so we do not to
-  // back up the move settings: they will remain constant.
-  uint32_t this_F, this_F_in_steps, this_F_start_in_steps, this_rampup, this_rampdown, this_total_steps;
-  uint8_t this_id;
-  static uint32_t la_cnt = 0;     // Counter: how many moves did we join?
+  // Entry speeds found in the reverse pass, move identifiers and the new
+  // ramps, indexed like movebuffer[]. Moves are numbered to find out wether
+  // the move was already executed and replaced while we were calculating.
+  uint32_t max_start[MOVEBUFFER_SIZE];
+  uint8_t ids[MOVEBUFFER_SIZE];
+  struct {
+    uint32_t entry, exit, rampup, rampdown, c;
+  } plan[MOVEBUFFER_SIZE];
+  uint8_t first, i, last, next;
+  uint32_t entry, exit;
+  DDA *dda, *next_dda;
+  uint8_t timeout = 0;
   #ifdef LOOKAHEAD_DEBUG
   static uint32_t moveno = 0;     // Debug counter to number the moves - helps while debugging
   moveno++;
@@ -306,141 +522,231 @@ void dda_join_moves(DDA *prev, DDA *current) {
   if ( ! prev || prev->nullmove || current->crossF == 0)
     return;
 
-    // Show the proposed crossing speed - this might get adjusted below.
-    if (DEBUG_DDA && (debug_flags & DEBUG_DDA))
-      sersendf_P(PSTR("Initial crossing speed: %lu\n"), current->crossF);
-
-  // Make sure we have 2 moves and the previous move is not already active
-  if (prev->live == 0) {
-    // Perform an atomic copy to preserve volatile parameters during the calculations
-    ATOMIC_START
-      prev_id = prev->id;
-      prev_F = prev->endpoint.F;
-      prev_F_start_in_steps = prev->start_steps;
-      prev_F_end_in_steps = prev->end_steps;
-      prev_rampup = prev->rampup_steps;
-      prev_rampdown = prev->rampdown_steps;
-      prev_total_steps = prev->total_steps;
-      crossF = current->crossF;
-      this_id = current->id;
-      this_F = current->endpoint.F;
-      this_total_steps = current->total_steps;
-    ATOMIC_END
+  // Show the proposed crossing speed.
+  if (DEBUG_DDA && (debug_flags & DEBUG_DDA))
+    sersendf_P(PSTR("Initial crossing speed: %u\n"), current->crossF);
 
-    // Here we have to distinguish between feedrate along the movement
-    // direction and feedrate of the fast axis. They can differ by a factor
-    // of 2.
-    // Along direction: F, crossF.
-    // Along fast axis already: start_steps, end_steps.
-    //
-    // All calculations here are done along the fast axis, so recalculate
-    // F and crossF to match this, too.
-    prev_F = muldiv(prev->fast_um, prev_F, prev->distance);
-    this_F = muldiv(current->fast_um, current->endpoint.F, current->distance);
-    crossF = muldiv(current->fast_um, crossF, current->distance);
-
-    prev_F_in_steps = ACCELERATE_RAMP_LEN(prev_F);
-    this_F_in_steps = ACCELERATE_RAMP_LEN(this_F);
-    crossF_in_steps = ACCELERATE_RAMP_LEN(crossF);
-
-    // Show the proposed crossing speed - this might get adjusted below
-    serprintf(PSTR("Initial crossing speed: %lu\r\n"), crossF_in_steps);
-
-    // Compute the maximum speed we can reach for crossing.
-    crossF_in_steps = MIN(crossF_in_steps, this_total_steps);
-    crossF_in_steps = MIN(crossF_in_steps, prev_total_steps + prev_F_start_in_steps);
-
-    if (crossF_in_steps == 0)
-      return;
-
-    // Build ramps for previous move.
-    if (crossF_in_steps == prev_F_in_steps) {
-      prev_rampup = prev_F_in_steps - prev_F_start_in_steps;
-      prev_rampdown = 0;
+  lookahead_joined++;
+  #ifdef QUEUE_STATISTICS
+    if (lookahead_crossF_sum > 0x7FFFFFFF) {
+      lookahead_crossF_sum >>= 1;
+      lookahead_crossF_n >>= 1;
     }
-    else if (crossF_in_steps < prev_F_start_in_steps) {
-      uint32_t extra, limit;
+    lookahead_crossF_sum += current->crossF;
+    lookahead_crossF_n++;
+    if (current->crossF < lookahead_crossF_min)
+      lookahead_crossF_min = current->crossF;
+  #endif
 
-      prev_rampup = 0;
-      prev_rampdown = prev_F_start_in_steps - crossF_in_steps;
-      extra = (prev_total_steps - prev_rampdown) >> 1;
-      limit = prev_F_in_steps - prev_F_start_in_steps;
-      extra = MIN(extra, limit);
+  // The corner allows this much, later joins look it up instead of
+  // calculating it again.
+  current->max_entry = dda_ramp_steps(current, current->crossF);
+
+  // Reverse pass. The current move always has to come to a stop at its end.
+  last = i = current - movebuffer;
+  exit = 0;
+  for (;;) {
+    dda = &movebuffer[i];
+    ids[i] = dda->id;
+
+    entry = dda->max_entry;
+    if (entry > exit + dda->total_steps)
+      entry = exit + dda->total_steps;
+    max_start[i] = entry;
+    first = i;
+
+    serprintf(PSTR("Reverse %u: max entry %lu\r\n"), i, entry);
+
+    // Can't go any faster at the start of this move? Then nothing changes
+    // for the moves before it.
+    if (dda->crossF == 0 || dda->optimal ||
+        (i != last && entry <= dda->start_steps))
+      break;
+
+    // Previous move can't be changed if it's already running or done.
+    next = dda_prev_move(i, last);
+    next_dda = &movebuffer[next];
+    if (next_dda->live || next_dda->done || next_dda->nullmove ||
+        next_dda->waitfor_temp || next == last)
+      break;
+
+    exit = dda_ramp_convert(entry, dda, next_dda);
+    i = next;
+  }
 
-      prev_rampup += extra;
-      prev_rampdown += extra;
+  // Forward pass. The entry speed of the first move stays untouched, it
+  // matches the exit speed of the move before it, which isn't re-planned.
+  entry = movebuffer[first].start_steps;
+  for (i = first; ; i = next) {
+    dda = &movebuffer[i];
+    next = dda_next_move(i, last);
+    next_dda = &movebuffer[next];
+
+    // Highest possible exit speed.
+    if (i == last) {
+      exit = 0;
     }
     else {
-      uint32_t extra, limit;
-
-      prev_rampup = crossF_in_steps - prev_F_start_in_steps;
-      prev_rampdown = 0;
-      extra = (prev_total_steps - prev_rampup) >> 1;
-      limit = prev_F_in_steps - crossF_in_steps;
-      extra = MIN(extra, limit);
-
-      prev_rampup += extra;
-      prev_rampdown += extra;
+      exit = dda_ramp_convert(max_start[next], next_dda, dda);
+      if (exit > entry + dda->total_steps)
+        exit = entry + dda->total_steps;
     }
-    prev_rampdown = prev_total_steps - prev_rampdown;
-    prev_F_end_in_steps = crossF_in_steps;
 
-    // Build ramps for current move.
-    if (crossF_in_steps == this_F_in_steps) {
-      this_rampup = 0;
-      this_rampdown = crossF_in_steps;
-    }
-    else {
-      this_rampup = 0;
-      this_rampdown = crossF_in_steps;
+    plan[i].entry = entry;
+    plan[i].exit = exit;
+    dda_ramps(dda, dda->endpoint.F, entry, exit,
+              &plan[i].rampup, &plan[i].rampdown);
+    plan[i].c = dda_ramp_c(dda, entry);
 
-      uint32_t extra = (this_total_steps - this_rampdown) >> 1;
-      uint32_t limit = this_F_in_steps - crossF_in_steps;
-      extra = MIN(extra, limit);
+    serprintf(PSTR("Forward %u: entry %lu  exit %lu  rampup %lu  rampdown %lu\r\n"),
+              i, entry, exit, plan[i].rampup, plan[i].rampdown);
 
-      this_rampup += extra;
-      this_rampdown += extra;
-    }
-    this_rampdown = this_total_steps - this_rampdown;
-    this_F_start_in_steps = crossF_in_steps;
+    if (i == last)
+      break;
 
-    serprintf(PSTR("prev_F_start: %lu\r\n"), prev_F_start_in_steps);
-    serprintf(PSTR("prev_F: %lu\r\n"), prev_F_in_steps);
-    serprintf(PSTR("prev_rampup: %lu\r\n"), prev_rampup);
-    serprintf(PSTR("prev_rampdown: %lu\r\n"), prev_total_steps - prev_rampdown);
-    serprintf(PSTR("crossF: %lu\r\n"), crossF_in_steps);
-    serprintf(PSTR("this_rampup: %lu\r\n"), this_rampup);
-    serprintf(PSTR("this_rampdown: %lu\r\n"), this_total_steps - this_rampdown);
-    serprintf(PSTR("this_F: %lu\r\n"), this_F_in_steps);
+    entry = dda_ramp_convert(exit, dda, next_dda);
+    if (entry > max_start[next])
+      entry = max_start[next];
+  }
 
-    uint8_t timeout = 0;
+  // Write the new ramps, all in a row. Calculating them took much longer,
+  // doing it in between would leave the first move plenty of time to get
+  // started or, worse, done, with the move after it not updated yet.
+  for (i = first; ; i = dda_next_move(i, last)) {
+    dda = &movebuffer[i];
 
     ATOMIC_START
-      // Evaluation: determine how we did...
-      lookahead_joined++;
-
-      // Determine if we are fast enough - if not, just leave the moves
-      // Note: to test if the previous move was already executed and replaced by a new
-      // move, we compare the DDA id.
-      if(prev->live == 0 && prev->id == prev_id && current->live == 0 && current->id == this_id) {
-        prev->end_steps = prev_F_end_in_steps;
-        prev->rampup_steps = prev_rampup;
-        prev->rampdown_steps = prev_rampdown;
-        current->rampup_steps = this_rampup;
-        current->rampdown_steps = this_rampdown;
-        current->end_steps = 0;
-        current->start_steps = this_F_start_in_steps;
-        la_cnt++;
-      } else
+      // Determine if we are fast enough - if not, just leave the moves.
+      // Note: to test if the move was already executed and replaced by a
+      // new move, we compare the DDA id.
+      if (dda->live == 0 && dda->id == ids[i]) {
+        dda->start_steps = plan[i].entry;
+        dda->end_steps = plan[i].exit;
+        dda->rampup_steps = plan[i].rampup;
+        dda->rampdown_steps = plan[i].rampdown;
+        dda->c = plan[i].c;
+        // Entry speed at the limit given by the corner? Then later passes
+        // can stop here.
+        dda->optimal = dda->crossF && plan[i].entry >= dda->max_entry;
+        dda_unprepare(dda);
+      }
+      else
         timeout = 1;
     ATOMIC_END
 
     // If we were not fast enough, any feedback will happen outside the atomic block:
-    if(timeout) {
+    if (timeout) {
       sersendf_P(PSTR("Error: look ahead not fast enough\r\n"));
       lookahead_timeout++;
+      break;
     }
+
+    if (i == last)
+      break;
   }
 }
 
+/**
+ * \brief Re-plan the movement queue for a changed feed override.
+ * \details Moves not started yet get the cruising speed of the new feed
+ * override, see dda_override_F(). When slowing down, speeds at the joints
+ * between them scale along, as far as each move can still decelerate to the
+ * next joint. The joint at the end of the live move stays, the live move
+ * itself is up to dda_clock(). A move starting faster than its new cruising
+ * speed keeps the old one, dda_clock() slows it down once it's live.
+ *
+ * When speeding up, joints stay as they are and dda_join_moves() raises them
+ * as far as possible, like when adding a move.
+ *
+ * \param [in] from is the feed override the queue was planned for, in percent.
+ */
+void dda_override_queue(uint16_t from) {
+  uint32_t entry, exit = 0, F, c_min, rampup, rampdown, c;
+  uint8_t i, last, done;
+  DDA *dda, *prev = NULL;
+
+  last = mb_head;
+  for (i = mb_tail; ; i = (i + 1) & (MOVEBUFFER_SIZE - 1)) {
+    dda = &movebuffer[i];
+
+    if (ACTION_TRANSPARENT(dda) && ! dda->done) {
+      // Moves around it are joined, keep prev.
+    }
+    else if (dda->live || dda->done || dda->nullmove || dda->waitfor_temp) {
+      // The next move starts with the speed planned already.
+      prev = NULL;
+    }
+    else {
+      entry = prev ? dda_ramp_convert(exit, prev, dda) : dda->start_steps;
+      if (i == last) {
+        exit = 0;
+      }
+      else {
+        // Ramp positions go with the square of the speed.
+        exit = dda->end_steps;
+        if (feed_override < from) {
+          exit = muldiv(exit, feed_override, from);
+          exit = muldiv(exit, feed_override, from);
+        }
+        if (entry > exit + dda->total_steps)
+          exit = entry - dda->total_steps;
+      }
+
+      F = dda_override_F(dda);
+      if (entry > dda_ramp_steps(dda, F))
+        F = dda->endpoint.F;
+      c_min = dda->move_duration / F;
+
+      dda_ramps(dda, F, entry, exit, &rampup, &rampdown);
+      c = dda_ramp_c(dda, entry);
+      if (c < c_min)
+        c = c_min;
+
+      serprintf(PSTR("Override %u: entry %lu  exit %lu  rampup %lu  rampdown %lu\r\n"),
+                i, entry, exit, rampup, rampdown);
+
+      done = 0;
+      ATOMIC_START
+        if (dda->live == 0 && dda->done == 0) {
+          dda->endpoint.F = F;
+          dda->c_min = c_min;
+          dda->start_steps = entry;
+          dda->end_steps = exit;
+          dda->rampup_steps = rampup;
+          dda->rampdown_steps = rampdown;
+          dda->c = c;
+          dda->optimal = 0;
+          dda_unprepare(dda);
+          done = 1;
+        }
+      ATOMIC_END
+
+      if (done) {
+        // Crossing speed for the new feedrates, for later joins.
+        if (dda->crossF) {
+          dda_find_crossing_speed(&movebuffer[dda_prev_move(i, last)], dda);
+          dda->max_entry = dda_ramp_steps(dda, dda->crossF);
+        }
+        prev = dda;
+      }
+      else {
+        // Started meanwhile. If the move before it got re-planned, its exit
+        // speed didn't match.
+        if (prev) {
+          sersendf_P(PSTR("Error: look ahead not fast enough\r\n"));
+          lookahead_timeout++;
+        }
+        prev = NULL;
+      }
+    }
+
+    if (i == last)
+      break;
+  }
+
+  dda = &movebuffer[last];
+  if (feed_override > from && ! dda->live && ! dda->done && ! dda->nullmove)
+    dda_join_moves(&movebuffer[dda_prev_move(last, last)], dda);
+}
+
 #endif /* LOOKAHEAD */
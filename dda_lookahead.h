@@ -26,29 +26,21 @@
 #error "Look-ahead requires steps per m to be identical on the X and Y axis (for now)"
 #endif
 
-// This is the same to ACCELERATE_RAMP_LEN but now the steps per m can be switched.
-// Note: use this with a macro so the float is removed by the preprocessor
-#define ACCELERATE_RAMP_SCALER(spm) (uint32_t)((7200000.0f * ACCELERATION) / (float)spm)
-#define ACCELERATE_RAMP_LEN2(speed, scaler) (((speed)*(speed)) / (scaler))
-
-// Pre-calculated factors to determine ramp lengths for all axis
-#define ACCELERATE_SCALER_X ACCELERATE_RAMP_SCALER(STEPS_PER_M_X)
-#define ACCELERATE_SCALER_Y ACCELERATE_RAMP_SCALER(STEPS_PER_M_Y)
-#define ACCELERATE_SCALER_Z ACCELERATE_RAMP_SCALER(STEPS_PER_M_Z)
-#define ACCELERATE_SCALER_E ACCELERATE_RAMP_SCALER(STEPS_PER_M_E)
-
-// To have a oneliner to fetch the correct scaler (pass the enum axis_e here)
-#define ACCELERATE_SCALER(axis) ((axis==X)?ACCELERATE_SCALER_X:((axis==Y)?ACCELERATE_SCALER_Y:((axis==Z)?ACCELERATE_SCALER_Z:ACCELERATE_SCALER_E)))
-
 #define MAX(a,b)  (((a)>(b))?(a):(b))
 #define MIN(a,b)  (((a)<(b))?(a):(b))
 
 void dda_find_crossing_speed(DDA *prev, DDA *current);
 void dda_join_moves(DDA *prev, DDA *current);
+void dda_override_queue(uint16_t from);
 
 // Debug counters
 extern uint32_t lookahead_joined;
 extern uint32_t lookahead_timeout;
+#ifdef QUEUE_STATISTICS
+extern uint32_t lookahead_crossF_sum;
+extern uint32_t lookahead_crossF_n;
+extern uint32_t lookahead_crossF_min;
+#endif
 
 #endif /* LOOKAHEAD */
 #endif /* DDA_LOOKAHEAD_H_ */
@@ -8,6 +8,8 @@
 #include <stdlib.h>
 #include <stdint.h>
 
+#include "preprocessor_math.h"
+
 /*!
   Pre-calculated constant values for axis um <=> steps conversions.
 
@@ -18,14 +20,69 @@ const axes_uint32_t PROGMEM axis_qn_P = {
   (uint32_t)STEPS_PER_M_X / UM_PER_METER,
   (uint32_t)STEPS_PER_M_Y / UM_PER_METER,
   (uint32_t)STEPS_PER_M_Z / UM_PER_METER,
-  (uint32_t)STEPS_PER_M_E / UM_PER_METER
+  (uint32_t)STEPS_PER_M_E / UM_PER_METER,
+  #if EXTRUDERS > 1
+  (uint32_t)STEPS_PER_M_E1 / UM_PER_METER,
+  #endif
+  #if EXTRUDERS > 2
+  (uint32_t)STEPS_PER_M_E2 / UM_PER_METER,
+  #endif
 };
 
 const axes_uint32_t PROGMEM axis_qr_P = {
   (uint32_t)STEPS_PER_M_X % UM_PER_METER,
   (uint32_t)STEPS_PER_M_Y % UM_PER_METER,
   (uint32_t)STEPS_PER_M_Z % UM_PER_METER,
-  (uint32_t)STEPS_PER_M_E % UM_PER_METER
+  (uint32_t)STEPS_PER_M_E % UM_PER_METER,
+  #if EXTRUDERS > 1
+  (uint32_t)STEPS_PER_M_E1 % UM_PER_METER,
+  #endif
+  #if EXTRUDERS > 2
+  (uint32_t)STEPS_PER_M_E2 % UM_PER_METER,
+  #endif
+};
+
+/*!
+  The same for steps => um conversions, see steps_to_um(). Steps per meter
+  are the divisor there.
+*/
+const axes_uint32_t PROGMEM axis_steps_per_m_P = {
+  (uint32_t)STEPS_PER_M_X,
+  (uint32_t)STEPS_PER_M_Y,
+  (uint32_t)STEPS_PER_M_Z,
+  (uint32_t)STEPS_PER_M_E,
+  #if EXTRUDERS > 1
+  (uint32_t)STEPS_PER_M_E1,
+  #endif
+  #if EXTRUDERS > 2
+  (uint32_t)STEPS_PER_M_E2,
+  #endif
+};
+
+const axes_uint32_t PROGMEM axis_um_qn_P = {
+  UM_PER_METER / (uint32_t)STEPS_PER_M_X,
+  UM_PER_METER / (uint32_t)STEPS_PER_M_Y,
+  UM_PER_METER / (uint32_t)STEPS_PER_M_Z,
+  UM_PER_METER / (uint32_t)STEPS_PER_M_E,
+  #if EXTRUDERS > 1
+  UM_PER_METER / (uint32_t)STEPS_PER_M_E1,
+  #endif
+  #if EXTRUDERS > 2
+  UM_PER_METER / (uint32_t)STEPS_PER_M_E2,
+  #endif
+};
+
+const axes_uint32_t PROGMEM axis_um_qr_P = {
+  UM_PER_METER % (uint32_t)STEPS_PER_M_X,
+  UM_PER_METER % (uint32_t)STEPS_PER_M_Y,
+  UM_PER_METER % (uint32_t)STEPS_PER_M_Z,
+  UM_PER_METER % (uint32_t)STEPS_PER_M_E,
+  #if EXTRUDERS > 1
+  UM_PER_METER % (uint32_t)STEPS_PER_M_E1,
+  #endif
+  #if EXTRUDERS > 2
+  UM_PER_METER % (uint32_t)STEPS_PER_M_E2,
+  #endif
 };
 
 /*!
@@ -239,6 +296,176 @@ uint16_t int_inv_sqrt(uint16_t a) {
   return x;
 }
 
+#ifdef RAMP_LOOKUP_TABLE
+/*!
+  Table for ramp_table_c(): 65535 / sqrt(1 + i / 16), for i = 0 ... 48. This
+  covers one factor of four, which is sufficient, because all other numbers
+  can be shifted into this range by multiples of 4. Calculated at compile
+  time.
+*/
+#define RAMP_T(i) (uint16_t)(262140. / SQRT(16. + (i)) + .5)
+#define RAMP_T8(i) RAMP_T(i), RAMP_T(i + 1), RAMP_T(i + 2), RAMP_T(i + 3), \
+                   RAMP_T(i + 4), RAMP_T(i + 5), RAMP_T(i + 6), RAMP_T(i + 7)
+
+static const uint16_t PROGMEM ramp_table_P[49] = {
+  RAMP_T8(0), RAMP_T8(8), RAMP_T8(16), RAMP_T8(24), RAMP_T8(32), RAMP_T8(40),
+  RAMP_T(48)
+};
+
+/*!
+  Step delay on an acceleration ramp, table based.
+  \param c0 delay of the first step
+  \param n position on the ramp, in steps, must be > 0
+  \return c0 / (2 * sqrt(n))
+
+  Same as (c0 * int_inv_sqrt(n)) >> 13, but uses a table lookup with linear
+  interpolation instead of a bitwise search. This is faster, more accurate
+  (table error below 0.05 %, the rest is rounding of the result) and works
+  for all n, not only 16-bit ones. For a comparison, see
+  research/ramp_table.c.
+*/
+uint32_t ramp_table_c(uint32_t c0, uint32_t n) {
+  uint8_t shift = 8;
+  uint16_t t, t1;
+  uint32_t c;
+
+  // Scale n into 0x4000 ... 0xFFFF. For n = 0x4000, c = c0 / 256.
+  while (n < 0x4000) {
+    n <<= 2;
+    shift--;
+  }
+  while (n > 0xFFFF) {
+    n >>= 2;
+    shift++;
+  }
+
+  t = pgm_read_word(&ramp_table_P[(n >> 10) - 16]);
+  t1 = pgm_read_word(&ramp_table_P[(n >> 10) - 15]);
+  t -= ((uint32_t)(t - t1) * (n & 0x3FF)) >> 10;
+
+  // c0 * t / 65536, without overflowing 32 bits.
+  c = (c0 >> 16) * t + (((c0 & 0xFFFF) * t) >> 16);
+
+  return c >> shift;
+}
+#endif /* RAMP_LOOKUP_TABLE */
+
+#ifdef ARC_SUPPORT
+/*!
+  Table for int_atan2() and int_rotate(): atan(2^-i), in radians * 2^28.
+*/
+static const uint32_t PROGMEM cordic_atan_P[CORDIC_STEPS] = {
+  210828714, 124459457, 65760959, 33381290, 16755422, 8385879, 4193963,
+  2097109, 1048571, 524287, 262144, 131072, 65536, 32768, 16384, 8192, 4096,
+  2048, 1024, 512, 256, 128
+};
+
+/// 1 / CORDIC gain, 0.60725 * 2^30.
+#define CORDIC_INV_GAIN 652032874UL
+
+/*!
+  Angle and length of a vector, CORDIC algorithm.
+  \param y Y component, |y| < 2^25
+  \param x X component, |x| < 2^25
+  \param *length receives the length of the vector, may be NULL
+  \return angle of the vector, -ANGLE_PI < angle <= ANGLE_PI
+
+  Rotates the vector onto the X axis in CORDIC_STEPS steps of decreasing
+  size, summing up the angles rotated by. Shifts and additions only, plus
+  one muldiv() for the length. Accuracy is about 2^-20 rad for the angle and
+  well below 1 for the length.
+*/
+int32_t int_atan2(int32_t y, int32_t x, uint32_t *length) {
+  int32_t angle = 0, dx, dy;
+  uint8_t i;
+
+  // CORDIC converges for +-90 degrees only, start from the right half plane.
+  if (x < 0) {
+    x = -x;
+    y = -y;
+    angle = ANGLE_PI;
+  }
+  // Some fractional bits for less rounding errors.
+  x <<= 4;
+  y <<= 4;
+
+  for (i = 0; i < CORDIC_STEPS; i++) {
+    dx = x >> i;
+    dy = y >> i;
+    if (y > 0) {
+      x += dy;
+      y -= dx;
+      angle += pgm_read_dword(&cordic_atan_P[i]);
+    }
+    else {
+      x -= dy;
+      y += dx;
+      angle -= pgm_read_dword(&cordic_atan_P[i]);
+    }
+  }
+
+  if (angle > ANGLE_PI)
+    angle -= 2 * ANGLE_PI;
+
+  if (length)
+    *length = (muldiv(x, CORDIC_INV_GAIN, 1UL << 30) + 8) >> 4;
+
+  return angle;
+}
+
+/*!
+  Rotate a vector, CORDIC algorithm.
+  \param *x X component, |x| < 2^25, receives the rotated one
+  \param *y Y component, |y| < 2^25, receives the rotated one
+  \param angle angle to rotate by, counter-clockwise, -2 * ANGLE_PI ...
+         2 * ANGLE_PI
+
+  Counterpart of int_atan2(), rotating by the given angle instead of onto
+  the X axis.
+*/
+void int_rotate(int32_t *x, int32_t *y, int32_t angle) {
+  int32_t vx, vy, dx, dy;
+  uint8_t i;
+
+  // Compensate the gain of the CORDIC steps right away, with some fractional
+  // bits for less rounding errors.
+  vx = muldiv(*x << 4, CORDIC_INV_GAIN, 1UL << 30);
+  vy = muldiv(*y << 4, CORDIC_INV_GAIN, 1UL << 30);
+
+  // Multiples of 90 degrees are exact, CORDIC does the rest.
+  while (angle > ANGLE_PI / 2) {
+    dx = vx;
+    vx = -vy;
+    vy = dx;
+    angle -= ANGLE_PI / 2;
+  }
+  while (angle < -ANGLE_PI / 2) {
+    dx = vx;
+    vx = vy;
+    vy = -dx;
+    angle += ANGLE_PI / 2;
+  }
+
+  for (i = 0; i < CORDIC_STEPS; i++) {
+    dx = vx >> i;
+    dy = vy >> i;
+    if (angle >= 0) {
+      vx -= dy;
+      vy += dx;
+      angle -= pgm_read_dword(&cordic_atan_P[i]);
+    }
+    else {
+      vx += dy;
+      vy -= dx;
+      angle += pgm_read_dword(&cordic_atan_P[i]);
+    }
+  }
+
+  *x = (vx + 8) >> 4;
+  *y = (vy + 8) >> 4;
+}
+#endif /* ARC_SUPPORT */
+
 // this is an ultra-crude pseudo-logarithm routine, such that:
 // 2 ^ msbloc(v) >= v
 /*! crude logarithm algorithm
@@ -256,20 +483,37 @@ const uint8_t msbloc (uint32_t v) {
   return 0;
 }
 
+/*!
+  Pre-calculated divisors for acc_ramp_len(), one per axis, using the
+  acceleration of that axis. Scaled by 16 for a smaller rounding error.
+
+  7200000 = 60 * 60 * 1000 * 2 (mm/min -> mm/s, steps/m -> steps/mm, factor 2)
+*/
+const axes_uint32_t PROGMEM acc_ramp_div_P = {
+  (uint32_t)((double)7200000. * 16. * ACCELERATION_X / STEPS_PER_M_X),
+  (uint32_t)((double)7200000. * 16. * ACCELERATION_Y / STEPS_PER_M_Y),
+  (uint32_t)((double)7200000. * 16. * ACCELERATION_Z / STEPS_PER_M_Z),
+  (uint32_t)((double)7200000. * 16. * ACCELERATION_E / STEPS_PER_M_E),
+  #if EXTRUDERS > 1
+  (uint32_t)((double)7200000. * 16. * ACCELERATION_E1 / STEPS_PER_M_E1),
+  #endif
+  #if EXTRUDERS > 2
+  (uint32_t)((double)7200000. * 16. * ACCELERATION_E2 / STEPS_PER_M_E2),
+  #endif
+};
+
 /*! Acceleration ramp length in steps.
- * \param feedrate Target feedrate of the accelerateion.
- * \param steps_per_m Steps/m of the axis.
+ * \param feedrate Target feedrate of the acceleration, in mm/min.
+ * \param axis Axis to accelerate, providing steps/m and acceleration.
  * \return Accelerating steps neccessary to achieve target feedrate.
  *
  * s = 1/2 * a * t^2, v = a * t ==> s = v^2 / (2 * a)
- * 7200000 = 60 * 60 * 1000 * 2 (mm/min -> mm/s, steps/m -> steps/mm, factor 2)
  *
  * Note: this function has shown to be accurate between 10 and 10'000 mm/s2 and
  *       2000 to 4096000 steps/m (and higher). The numbers are a few percent
  *       too high at very low acceleration. Test code see commit message.
  */
-uint32_t acc_ramp_len(uint32_t feedrate, uint32_t steps_per_m) {
-  return (feedrate * feedrate) /
-         (((uint32_t)7200000UL * ACCELERATION) / steps_per_m);
+uint32_t acc_ramp_len(uint32_t feedrate, enum axis_e axis) {
+  return muldiv(feedrate, feedrate << 4, pgm_read_dword(&acc_ramp_div_P[axis]));
 }
 
@@ -34,6 +34,17 @@ inline int32_t um_to_steps(int32_t distance, enum axis_e a) {
                   pgm_read_dword(&axis_qr_P[a]), UM_PER_METER);
 }
 
+extern const axes_uint32_t PROGMEM axis_steps_per_m_P;
+extern const axes_uint32_t PROGMEM axis_um_qn_P;
+extern const axes_uint32_t PROGMEM axis_um_qr_P;
+
+static int32_t steps_to_um(int32_t, enum axis_e) __attribute__ ((always_inline));
+inline int32_t steps_to_um(int32_t steps, enum axis_e a) {
+  return muldivQR(steps, pgm_read_dword(&axis_um_qn_P[a]),
+                  pgm_read_dword(&axis_um_qr_P[a]),
+                  pgm_read_dword(&axis_steps_per_m_P[a]));
+}
+
 // approximate 2D distance
 uint32_t approx_distance(uint32_t dx, uint32_t dy);
 
@@ -46,14 +57,29 @@ uint16_t int_sqrt(uint32_t a);
 // integer inverse square root, 12bits precision
 uint16_t int_inv_sqrt(uint16_t a);
 
+#ifdef RAMP_LOOKUP_TABLE
+// step delay on an acceleration ramp, c0 / (2 * sqrt(n)), table based
+uint32_t ramp_table_c(uint32_t c0, uint32_t n);
+#endif
+
+#ifdef ARC_SUPPORT
+// Angles for int_atan2() and int_rotate(), in radians * 2^28.
+#define ANGLE_PI 843314857L
+#define CORDIC_STEPS 22
+
+// angle and length of a vector
+int32_t int_atan2(int32_t y, int32_t x, uint32_t *length);
+
+// rotate a vector by an angle
+void int_rotate(int32_t *x, int32_t *y, int32_t angle);
+#endif
+
 // this is an ultra-crude pseudo-logarithm routine, such that:
 // 2 ^ msbloc(v) >= v
 const uint8_t msbloc (uint32_t v);
 
 // Calculates acceleration ramp length in steps.
-uint32_t acc_ramp_len(uint32_t feedrate, uint32_t steps_per_m);
-
-// For X axis only, should become obsolete:
-#define ACCELERATE_RAMP_LEN(speed) (((speed)*(speed)) / (uint32_t)((7200000.0f * ACCELERATION) / (float)STEPS_PER_M_X))
+extern const axes_uint32_t PROGMEM acc_ramp_div_P;
+uint32_t acc_ramp_len(uint32_t feedrate, enum axis_e axis);
 
 #endif	/* _DDA_MATHS_H */
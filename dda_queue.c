@@ -5,6 +5,7 @@
 */
 
 #include	<string.h>
+#include	<stdlib.h>
 #ifndef SIMULATOR
 #include	<avr/interrupt.h>
 #endif
@@ -14,10 +15,14 @@
 #include	"serial.h"
 #include	"sermsg.h"
 #include	"temp.h"
+#include	"heater.h"
+#include	"pinio.h"
 #include	"delay.h"
 #include	"sersendf.h"
 #include	"clock.h"
 #include	"memory_barrier.h"
+#include	"dda_lookahead.h"
+#include	"dda_maths.h"
 
 /// movebuffer head pointer. Points to the last move in the queue.
 /// this variable is used both in and out of interrupts, but is
@@ -37,6 +42,43 @@ uint8_t	mb_tail = 0;
 /// The size does not need to be a power of 2 anymore!
 DDA BSS movebuffer[MOVEBUFFER_SIZE];
 
+/// Heater and temperature changes done by next_move(), waiting for
+/// queue_actions() to apply them outside of the step interrupt. Only the
+/// last value for each heater or sensor matters, so these can't overflow.
+static uint8_t action_heater[NUM_HEATERS];
+static uint16_t action_temp[NUM_TEMP_SENSORS];
+/// bool: for each heater or sensor, a value above is waiting
+static volatile uint8_t action_heater_pending[NUM_HEATERS];
+static volatile uint8_t action_temp_pending[NUM_TEMP_SENSORS];
+/// bool: any of them is waiting
+static volatile uint8_t action_pending = 0;
+
+#ifdef QUEUE_STATISTICS
+/// queue depth histogram, sampled by dda_clock() while moving.
+/// queue_depth[n] counts clock ticks with n moves waiting behind the
+/// current one.
+uint32_t queue_depth[MOVEBUFFER_SIZE];
+
+/// times the queue ran dry while moves kept coming, see enqueue_commit()
+uint32_t queue_underruns = 0;
+
+/// bool: moves are coming in, no queue_wait() or wait for temperatures
+/// since the last one
+static uint8_t queue_flowing = 0;
+#endif
+
+#ifdef COALESCE_MOVES
+/// move held back to merge more moves into it, see enqueue_coalesce().
+/// It starts at startpoint, which doesn't change until it gets queued.
+static TARGET coalesce_target;
+
+/// bool: coalesce_target is valid
+static uint8_t coalesce_pending = 0;
+
+/// sum of the corner deviations dropped from the held move so far, in um
+static uint32_t coalesce_error;
+#endif
+
 /// check if the queue is completely full
 uint8_t queue_full() {
 	MEMORY_BARRIER();
@@ -58,6 +100,12 @@ uint8_t queue_empty() {
 	return result;
 }
 
+/// number of moves queued behind the one currently executing
+uint8_t queue_waiting() {
+	MEMORY_BARRIER();
+	return (mb_head - mb_tail) & (MOVEBUFFER_SIZE - 1);
+}
+
 /// Return the current movement, or NULL, if there's no movement going on.
 DDA *queue_current_movement() {
   DDA* current;
@@ -83,11 +131,17 @@ void queue_step() {
 	if (current_movebuffer->live) {
 		if (current_movebuffer->waitfor_temp) {
 			setTimer(HEATER_WAIT_TIMEOUT);
-			if (temp_achieved()) {
+			// Temperatures set by actions before apply first.
+			if ( ! action_pending && temp_achieved()) {
 				current_movebuffer->live = current_movebuffer->done = 0;
 				serial_writestr_P(PSTR("Temp achieved\n"));
 			}
 		}
+		else if (current_movebuffer->action) {
+			// dwell time is over
+			current_movebuffer->live = 0;
+			current_movebuffer->done = 1;
+		}
 		else {
 			// NOTE: dda_step makes this interrupt interruptible for some time,
 			//       see STEP_INTERRUPT_INTERRUPTIBLE.
@@ -100,10 +154,9 @@ void queue_step() {
 		next_move();
 }
 
-/// add a move to the movebuffer
-/// \note this function waits for space to be available if necessary, check queue_full() first if waiting is a problem
-/// This is the only function that modifies mb_head and it always called from outside an interrupt.
-void enqueue_home(TARGET *t, uint8_t endstop_check, uint8_t endstop_stop_cond) {
+/// get the next free queue entry, initialised to a known state
+/// \note this function waits for space to be available if necessary
+static DDA *enqueue_reserve(void) {
 	// don't call this function when the queue is full, but just in case, wait for a move to complete and free up the space for the passed target
 	while (queue_full())
 		delay_us(100);
@@ -116,16 +169,15 @@ void enqueue_home(TARGET *t, uint8_t endstop_check, uint8_t endstop_stop_cond) {
   // Initialise queue entry to a known state. This also clears flags like
   // dda->live, dda->done and dda->wait_for_temp.
   new_movebuffer->allflags = 0;
+  new_movebuffer->action = ACTION_NONE;
 
-  if (t != NULL) {
-		new_movebuffer->endstop_check = endstop_check;
-		new_movebuffer->endstop_stop_cond = endstop_stop_cond;
-	}
-	else {
-		// it's a wait for temp
-		new_movebuffer->waitfor_temp = 1;
-	}
-  dda_create(new_movebuffer, t);
+  return new_movebuffer;
+}
+
+/// make the entry returned by enqueue_reserve() part of the queue
+static void enqueue_commit(void) {
+	uint8_t h = mb_head + 1;
+	h &= (MOVEBUFFER_SIZE - 1);
 
 	// make certain all writes to global memory
 	// are flushed before modifying mb_head.
@@ -140,10 +192,246 @@ void enqueue_home(TARGET *t, uint8_t endstop_check, uint8_t endstop_stop_cond) {
   ATOMIC_END
 
 	if (isdead) {
+    #ifdef QUEUE_STATISTICS
+      if (queue_flowing)
+        queue_underruns++;
+    #endif
 		next_move();
 		// Compensate for the cli() in setTimer().
 		sei();
 	}
+
+  #ifdef QUEUE_STATISTICS
+    // Moves after a wait for temperatures find an empty queue on purpose.
+    queue_flowing = ! movebuffer[h].waitfor_temp;
+  #endif
+}
+
+/// add a move to the movebuffer
+/// \note this function waits for space to be available if necessary, check queue_full() first if waiting is a problem
+/// This is the only function that modifies mb_head and it always called from outside an interrupt.
+void enqueue_home(TARGET *t, uint8_t endstop_check, uint8_t endstop_stop_cond) {
+	DDA* new_movebuffer = enqueue_reserve();
+
+  if (t != NULL) {
+		new_movebuffer->endstop_check = endstop_check;
+		new_movebuffer->endstop_stop_cond = endstop_stop_cond;
+	}
+	else {
+		// it's a wait for temp
+		new_movebuffer->waitfor_temp = 1;
+	}
+  dda_create(new_movebuffer, t);
+
+  // Moves smaller than a step and pure speed changes add to the next move,
+  // see dda_create().
+  if (new_movebuffer->nullmove && ! new_movebuffer->endstop_check)
+    return;
+
+  enqueue_commit();
+}
+
+#ifdef ARC_SUPPORT
+/// add an arc to the movebuffer
+/// \param *t end point of the arc
+/// \param i X offset of the center from the current position, in um
+/// \param j Y offset of the center from the current position, in um
+/// \param ccw bool: counter-clockwise arc (G3)?
+/// \note this function waits for space to be available if necessary, like enqueue_home()
+void enqueue_arc(TARGET *t, int32_t i, int32_t j, uint8_t ccw) {
+	DDA* new_movebuffer = enqueue_reserve();
+
+  new_movebuffer->endstop_check = 0;
+  new_movebuffer->endstop_stop_cond = 0;
+  new_movebuffer->arc = 1;
+  new_movebuffer->arc_center[X] = i;
+  new_movebuffer->arc_center[Y] = j;
+  new_movebuffer->arc_angle = ccw ? 1 : -1;
+  dda_create(new_movebuffer, t);
+
+  enqueue_commit();
+}
+#endif
+
+#ifdef COALESCE_MOVES
+/// add a G1 move to the movebuffer, merging it with the move before
+/// \param *t end point of the move
+/// Slicers cut curves into many short moves, often shorter than planning
+/// them takes. A move goes on the same line as the move before if its end
+/// point is less than COALESCE_MOVES um off the extended line, so this
+/// move gets dropped, at the same feedrate and extrusion rate. The
+/// deviations dropped add up, the merged move never bends more than
+/// COALESCE_MOVES um in total.
+/// The last move is held back while at least two moves are queued, as the
+/// next one might merge with it. enqueue_flush() queues it.
+/// \note this function waits for space to be available if necessary, like enqueue_home()
+void enqueue_coalesce(TARGET *t) {
+  if (coalesce_pending && t->F == coalesce_target.F &&
+      t->e_relative == coalesce_target.e_relative) {
+    axes_int32_t a, b;
+    uint32_t la, lb, deviation = 0;
+    int32_t e_a, e_b, d;
+    enum axis_e i;
+
+    for (i = X; i < E; i++) {
+      a[i] = coalesce_target.axis[i] - startpoint.axis[i];
+      b[i] = t->axis[i] - coalesce_target.axis[i];
+    }
+    la = approx_distance_3(labs(a[X]), labs(a[Y]), labs(a[Z]));
+    lb = approx_distance_3(labs(b[X]), labs(b[Y]), labs(b[Z]));
+
+    if (la && lb) {
+      // Where this move would end if it went straight on.
+      for (i = X; i < E; i++) {
+        d = labs(b[i] - muldiv(a[i], lb, la));
+        if ((uint32_t)d > deviation)
+          deviation = d;
+      }
+
+      // Same with E, allowing 1/32 off the extrusion rate.
+      e_a = coalesce_target.axis[E];
+      e_b = t->axis[E];
+      if ( ! t->e_relative) {
+        e_a -= startpoint.axis[E];
+        e_b -= coalesce_target.axis[E];
+      }
+      d = muldiv(e_a, lb, la);
+      if (labs(e_b - d) > labs(d) / 32 + 1)
+        deviation = UINT32_MAX;
+
+      if (deviation <= COALESCE_MOVES - coalesce_error) {
+        coalesce_error += deviation;
+        for (i = X; i < E; i++)
+          coalesce_target.axis[i] = t->axis[i];
+        coalesce_target.axis[E] = t->e_relative ? e_a + e_b : t->axis[E];
+        return;
+      }
+    }
+  }
+
+  enqueue_flush();
+  memcpy(&coalesce_target, t, sizeof(TARGET));
+  coalesce_pending = 1;
+  coalesce_error = 0;
+
+  // Nothing to wait for if the queue is about to run dry.
+  if (queue_waiting() < 2)
+    enqueue_flush();
+}
+
+/// queue the move held back by enqueue_coalesce()
+/// Anything else than a G1 move sees all moves queued, as well as the main
+/// loop when the queue runs low, see clock_10ms().
+void enqueue_flush() {
+  if (coalesce_pending) {
+    coalesce_pending = 0;
+    enqueue(&coalesce_target);
+  }
+}
+#endif
+
+/// add an action to the movebuffer, done in order with the moves
+/// \param action one of enum action_e
+/// \param index heater or temperature sensor
+/// \param value value to set, for a dwell the time in milliseconds
+/// Heater and temperature changes happen between two moves and look-ahead
+/// joins these moves as if there were nothing between them, see
+/// ACTION_TRANSPARENT. A dwell stops movement.
+/// \note this function waits for space to be available if necessary, like enqueue_home()
+void enqueue_action(uint8_t action, uint8_t index, uint16_t value) {
+	DDA* new_movebuffer = enqueue_reserve();
+
+  new_movebuffer->nullmove = 1;
+  new_movebuffer->action = action;
+  new_movebuffer->action_index = index;
+  new_movebuffer->action_value = value;
+  dda_create(new_movebuffer, NULL);
+
+  enqueue_commit();
+}
+
+/// do the action of a movebuffer entry, see enqueue_action()
+/// Called from the step interrupt. heater_set() may wait for the power
+/// supply and temp_set() may talk to an intercom board, so these two only
+/// get recorded here and queue_actions() does them.
+static void action_start(DDA *dda) {
+  uint8_t i = dda->action_index;
+
+  switch (dda->action) {
+    case ACTION_HEATER:
+      if (i < NUM_HEATERS) {
+        action_heater[i] = dda->action_value;
+        action_heater_pending[i] = 1;
+        action_pending = 1;
+      }
+      break;
+    case ACTION_TEMP:
+      if (i < NUM_TEMP_SENSORS) {
+        action_temp[i] = dda->action_value;
+        action_temp_pending[i] = 1;
+        action_pending = 1;
+      }
+      break;
+    case ACTION_DWELL:
+      // queue_step() ends it
+      dda->live = 1;
+      setTimer((uint32_t)dda->action_value MS);
+      return;
+  }
+  dda->done = 1;
+}
+
+/// apply heater and temperature changes done in the movement queue
+/// Called from clock(), outside of interrupts, see action_start().
+void queue_actions() {
+  uint8_t i, pending;
+  uint16_t value;
+
+  if ( ! action_pending)
+    return;
+
+  for (i = 0; i < NUM_HEATERS; i++) {
+    ATOMIC_START
+      pending = action_heater_pending[i];
+      value = action_heater[i];
+      action_heater_pending[i] = 0;
+    ATOMIC_END
+    if (pending)
+      heater_set(i, value);
+  }
+  for (i = 0; i < NUM_TEMP_SENSORS; i++) {
+    ATOMIC_START
+      pending = action_temp_pending[i];
+      value = action_temp[i];
+      action_temp_pending[i] = 0;
+    ATOMIC_END
+    if (pending)
+      temp_set(i, value);
+  }
+
+  // New ones may have arrived meanwhile, they get done on the next call.
+  ATOMIC_START
+    action_pending = 0;
+    for (i = 0; i < NUM_HEATERS; i++)
+      action_pending |= action_heater_pending[i];
+    for (i = 0; i < NUM_TEMP_SENSORS; i++)
+      action_pending |= action_temp_pending[i];
+  ATOMIC_END
+}
+
+/// add setting the step positions to the movebuffer
+/// Homing and tool changes move the origin while moves are still queued, so
+/// the new origin applies when the moves before it are done, see dda_start().
+/// endpoint carries startpoint_steps, in steps, not um.
+/// \note this function waits for space to be available if necessary, like enqueue_home()
+void enqueue_position() {
+	DDA* new_movebuffer = enqueue_reserve();
+
+  new_movebuffer->nullmove = 1;
+  new_movebuffer->set_position = 1;
+  dda_create(new_movebuffer, &startpoint_steps);
+
+  enqueue_commit();
 }
 
 /// go to the next move.
@@ -169,6 +457,9 @@ void next_move() {
 			current_movebuffer->live = 1;
 			setTimer(HEATER_WAIT_TIMEOUT);
 		}
+		else if (current_movebuffer->action) {
+			action_start(current_movebuffer);
+		}
 		else {
 			dda_start(current_movebuffer);
 		}
@@ -181,6 +472,45 @@ void print_queue() {
 	sersendf_P(PSTR("Q%d/%d%c"), mb_tail, mb_head, (queue_full()?'F':(queue_empty()?'E':' ')));
 }
 
+#ifdef QUEUE_STATISTICS
+/// report queue statistics, see M225
+/// \param reset bool: start counting anew afterwards
+/// Q: is the depth histogram, U: the number of underruns. With LOOKAHEAD,
+/// J: moves joined, T: look-ahead timeouts and F: average/minimum crossing
+/// speed of the moves joined, in mm/min.
+void print_queue_statistics(uint8_t reset) {
+  uint32_t depth[MOVEBUFFER_SIZE];
+  uint8_t i;
+
+  ATOMIC_START
+    memcpy(depth, queue_depth, sizeof(depth));
+    if (reset)
+      memset(queue_depth, 0, sizeof(queue_depth));
+  ATOMIC_END
+
+  serial_writestr_P(PSTR("Q:"));
+  for (i = 0; i < MOVEBUFFER_SIZE; i++)
+    sersendf_P(PSTR("%lu%c"), depth[i], (i < MOVEBUFFER_SIZE - 1) ? '/' : ' ');
+  sersendf_P(PSTR("U:%lu"), queue_underruns);
+  #ifdef LOOKAHEAD
+    sersendf_P(PSTR(" J:%lu T:%lu F:%lu/%lu"), lookahead_joined,
+               lookahead_timeout,
+               lookahead_crossF_n ?
+                 lookahead_crossF_sum / lookahead_crossF_n : 0,
+               lookahead_crossF_n ? lookahead_crossF_min : 0);
+  #endif
+
+  if (reset) {
+    queue_underruns = 0;
+    #ifdef LOOKAHEAD
+      lookahead_joined = lookahead_timeout = 0;
+      lookahead_crossF_sum = lookahead_crossF_n = 0;
+      lookahead_crossF_min = 0xFFFFFFFF;
+    #endif
+  }
+}
+#endif
+
 /// dump queue for emergency stop.
 /// Make sure to have all timers stopped with timer_stop() or
 /// unexpected things might happen.
@@ -194,7 +524,14 @@ void queue_flush() {
 }
 
 /// wait for queue to empty
+/// Heater and temperature changes from the queue have taken effect, too.
 void queue_wait() {
+  #ifdef QUEUE_STATISTICS
+    queue_flowing = 0;
+  #endif
 	while (queue_empty() == 0)
 		clock();
+
+  // The last actions may still be waiting, see action_start().
+  queue_actions();
 }
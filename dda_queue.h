@@ -14,6 +14,10 @@
 extern uint8_t	mb_head;
 extern uint8_t	mb_tail;
 extern DDA movebuffer[MOVEBUFFER_SIZE];
+#ifdef QUEUE_STATISTICS
+extern uint32_t queue_depth[MOVEBUFFER_SIZE];
+extern uint32_t queue_underruns;
+#endif
 
 /*
 	methods
@@ -22,6 +26,7 @@ extern DDA movebuffer[MOVEBUFFER_SIZE];
 // queue status methods
 uint8_t queue_full(void);
 uint8_t queue_empty(void);
+uint8_t queue_waiting(void);
 DDA *queue_current_movement(void);
 
 // take one step
@@ -36,12 +41,39 @@ inline void enqueue(TARGET *t) {
   enqueue_home(t, 0, 0);
 }
 
+#ifdef ARC_SUPPORT
+// add an arc around the center at offset i, j from the current position
+void enqueue_arc(TARGET *t, int32_t i, int32_t j, uint8_t ccw);
+#endif
+
+#ifdef COALESCE_MOVES
+// add a G1 move, merging it with the move before if it goes straight on
+void enqueue_coalesce(TARGET *t);
+
+// queue the move held back by enqueue_coalesce()
+void enqueue_flush(void);
+#endif
+
+// add a heater or temperature change or a dwell to the queue
+void enqueue_action(uint8_t action, uint8_t index, uint16_t value);
+
+// apply heater and temperature changes done in the queue, see clock()
+void queue_actions(void);
+
+// set the step positions to startpoint_steps once the moves before are done
+void enqueue_position(void);
+
 // called from step timer when current move is complete
 void next_move(void);
 
 // print queue status
 void print_queue(void);
 
+#ifdef QUEUE_STATISTICS
+// print queue depth histogram, underruns and look-ahead statistics
+void print_queue_statistics(uint8_t reset);
+#endif
+
 // flush the queue for eg; emergency stop
 void queue_flush(void);
 
@@ -152,6 +152,32 @@ void gcode_parse_char(uint8_t c) {
 					if (DEBUG_ECHO && (debug_flags & DEBUG_ECHO))
             serwrite_uint32(next_target.target.axis[E]);
 					break;
+				#ifdef ARC_SUPPORT
+				case 'I':
+					if (next_target.option_inches)
+						next_target.I = decfloat_to_int(&read_digit, 25400);
+					else
+						next_target.I = decfloat_to_int(&read_digit, 1000);
+					if (DEBUG_ECHO && (debug_flags & DEBUG_ECHO))
+						serwrite_int32(next_target.I);
+					break;
+				case 'J':
+					if (next_target.option_inches)
+						next_target.J = decfloat_to_int(&read_digit, 25400);
+					else
+						next_target.J = decfloat_to_int(&read_digit, 1000);
+					if (DEBUG_ECHO && (debug_flags & DEBUG_ECHO))
+						serwrite_int32(next_target.J);
+					break;
+				case 'R':
+					if (next_target.option_inches)
+						next_target.R = decfloat_to_int(&read_digit, 25400);
+					else
+						next_target.R = decfloat_to_int(&read_digit, 1000);
+					if (DEBUG_ECHO && (debug_flags & DEBUG_ECHO))
+						serwrite_int32(next_target.R);
+					break;
+				#endif
 				case 'F':
 					// just use raw integer, we need move distance and n_steps to convert it to a useful value, so wait until we have those to convert it
 					if (next_target.option_inches)
@@ -170,6 +196,11 @@ void gcode_parse_char(uint8_t c) {
 					// if this is heater PID stuff, multiply by PID_SCALE because we divide by PID_SCALE later on
 					else if ((next_target.M >= 130) && (next_target.M <= 132))
 						next_target.S = decfloat_to_int(&read_digit, PID_SCALE);
+					#ifdef PRESSURE_ADVANCE
+					// pressure advance factor, in milliseconds
+					else if (next_target.M == 233)
+						next_target.S = decfloat_to_int(&read_digit, 1000);
+					#endif
 					else
 						next_target.S = decfloat_to_int(&read_digit, 1);
 					if (DEBUG_ECHO && (debug_flags & DEBUG_ECHO))
@@ -269,6 +300,17 @@ void gcode_parse_char(uint8_t c) {
         case 'N':
           next_target.seen_N = 1;
           break;
+        #ifdef ARC_SUPPORT
+        case 'I':
+          next_target.seen_I = 1;
+          break;
+        case 'J':
+          next_target.seen_J = 1;
+          break;
+        case 'R':
+          next_target.seen_R = 1;
+          break;
+        #endif
         case '*':
           next_target.seen_checksum = 1;
           break;
@@ -372,6 +414,10 @@ void gcode_parse_char(uint8_t c) {
       next_target.seen_G = next_target.seen_M = next_target.seen_checksum = \
       next_target.seen_semi_comment = next_target.seen_parens_comment = \
       next_target.checksum_read = next_target.checksum_calculated = 0;
+		#ifdef ARC_SUPPORT
+			next_target.seen_I = next_target.seen_J = next_target.seen_R = 0;
+			next_target.I = next_target.J = 0;
+		#endif
 		// last_field and read_digit are reset above already
 
 		if (next_target.option_all_relative) {
@@ -35,6 +35,11 @@ typedef struct {
 		uint8_t					seen_P	:1;
 		uint8_t					seen_T	:1;
 		uint8_t					seen_N	:1;
+		#ifdef ARC_SUPPORT
+		uint8_t					seen_I	:1;
+		uint8_t					seen_J	:1;
+		uint8_t					seen_R	:1;
+		#endif
 		uint8_t					seen_checksum				:1; ///< seen a checksum?
 		uint8_t					seen_semi_comment		:1; ///< seen a semicolon?
 		uint8_t					seen_parens_comment	:1; ///< seen an open parenthesis
@@ -52,6 +57,12 @@ typedef struct {
 
 	uint8_t						T;				///< T word (tool index)
 
+	#ifdef ARC_SUPPORT
+	int32_t						I;				///< I word, arc center X offset, in um
+	int32_t						J;				///< J word, arc center Y offset, in um
+	int32_t						R;				///< R word, arc radius, in um
+	#endif
+
 	uint32_t					N;				///< line number
 	uint32_t					N_expected;	///< expected line number
 
@@ -5,6 +5,7 @@
 */
 
 #include	<string.h>
+#include	<stdlib.h>
 #ifndef SIMULATOR
 #include	<avr/interrupt.h>
 #endif
@@ -13,6 +14,7 @@
 
 #include	"dda.h"
 #include	"dda_queue.h"
+#include	"dda_maths.h"
 #include	"watchdog.h"
 #include	"delay.h"
 #include	"serial.h"
@@ -33,6 +35,100 @@ uint8_t tool;
 /// the tool to be changed when we get an M6
 uint8_t next_tool;
 
+#if EXTRUDERS > 1
+#ifndef E1_OFFSET_X
+  #define E1_OFFSET_X 0
+#endif
+#ifndef E1_OFFSET_Y
+  #define E1_OFFSET_Y 0
+#endif
+#ifndef E2_OFFSET_X
+  #define E2_OFFSET_X 0
+#endif
+#ifndef E2_OFFSET_Y
+  #define E2_OFFSET_Y 0
+#endif
+
+/// \var tool_offset_P
+/// \brief nozzle position of each tool relative to the first one, X and Y,
+///        in um
+static const int32_t PROGMEM tool_offset_P[EXTRUDERS][2] = {
+  { 0, 0 },
+  { (int32_t)(E1_OFFSET_X * 1000.), (int32_t)(E1_OFFSET_Y * 1000.) },
+  #if EXTRUDERS > 2
+  { (int32_t)(E2_OFFSET_X * 1000.), (int32_t)(E2_OFFSET_Y * 1000.) },
+  #endif
+};
+#endif
+
+/** \brief Change the tool, which is the extruder E moves.
+  \param t the new tool, 0 for E, 1 for E1, ...
+
+  G-code coordinates are those of the nozzle of the current tool. Changing
+  the tool shifts them by the difference of the nozzle offsets, so the next
+  move puts the new nozzle where the old one would have been. Coordinates
+  given on the same line are already those of the new tool.
+*/
+static void tool_change(uint8_t t) {
+  #if EXTRUDERS > 1
+    uint8_t from = next_target.target.tool;
+    enum axis_e i;
+    int32_t d;
+
+    if (t >= EXTRUDERS) {
+      sersendf_P(PSTR("E: Bad tool %d"), t);
+      return;
+    }
+
+    for (i = X; i < Z; i++) {
+      d = (int32_t)pgm_read_dword(&tool_offset_P[t][i]) -
+          (int32_t)pgm_read_dword(&tool_offset_P[from][i]);
+      startpoint.axis[i] += d;
+      if ((i == X && ! next_target.seen_X) ||
+          (i == Y && ! next_target.seen_Y) || next_target.option_all_relative)
+        next_target.target.axis[i] += d;
+    }
+    startpoint.tool = next_target.target.tool = t;
+    // Absolute E of the new extruder counts from the current E.
+    dda_new_startpoint();
+  #endif
+  tool = t;
+}
+
+
+#ifdef ARC_SUPPORT
+/** \brief Find the center of an arc given by its radius.
+  \param ccw bool: counter-clockwise arc?
+  \param *i receives the X offset of the center from the current position
+  \param *j receives the Y offset of the center from the current position
+
+  Works on next_target.R and next_target.target, all in um. The center is
+  on the perpendicular bisector of the chord from the current position to the
+  target. A radius too short for this chord results in half a circle.
+*/
+static void arc_center_from_radius(uint8_t ccw, int32_t *i, int32_t *j) {
+  uint32_t chord, radius, half, h = 0;
+  int32_t angle;
+
+  angle = int_atan2(next_target.target.axis[Y] - startpoint.axis[Y],
+                    next_target.target.axis[X] - startpoint.axis[X], &chord);
+  radius = labs(next_target.R);
+  half = chord / 2;
+
+  // h = sqrt(radius^2 - half^2) = sqrt((radius - half) * (radius + half)),
+  // calculated without overflowing 32 bits.
+  if (radius > half)
+    h = muldiv(radius + half,
+               int_sqrt(muldiv(radius - half, 1UL << 30, radius + half)),
+               1UL << 15);
+
+  // Seen along the chord, the center of a counter-clockwise arc shorter than
+  // half a circle is on the left side.
+  *i = half;
+  *j = (ccw == (next_target.R > 0)) ? (int32_t)h : -(int32_t)h;
+  int_rotate(i, j, angle);
+}
+#endif
 
 /************************************************************************//**
 
@@ -47,6 +143,14 @@ uint8_t next_tool;
 void process_gcode_command() {
 	uint32_t	backup_f;
 
+  #ifdef COALESCE_MOVES
+    // Everything but absolute G1 moves sees all moves queued, including the
+    // position in startpoint.
+    if ( ! next_target.seen_G || next_target.G != 1 || next_target.seen_T ||
+        next_target.option_all_relative)
+      enqueue_flush();
+  #endif
+
 	// convert relative to absolute
 	if (next_target.option_all_relative) {
     next_target.target.axis[X] += startpoint.axis[X];
@@ -96,8 +200,11 @@ void process_gcode_command() {
 	    //? Example: T1
 	    //?
 	    //? Select extruder number 1 to build with.  Extruder numbering starts at 0.
+	    //? The new extruder is used right away, without waiting for M6. See
+	    //? EXTRUDERS and E1_OFFSET_X in config.h.
 
 	    next_tool = next_target.T;
+	    tool_change(next_tool);
 	}
 
 	if (next_target.seen_G) {
@@ -123,14 +230,39 @@ void process_gcode_command() {
 				//?
 				//? Go in a straight line from the current (X, Y) point to the point (90.6, 13.8), extruding material as the move happens from the current extruded length to a length of 22.4 mm.
 				//?
-				enqueue(&next_target.target);
+				//? With COALESCE_MOVES in config.h, moves going on in the same direction merge into one.
+				//?
+				#ifdef COALESCE_MOVES
+					enqueue_coalesce(&next_target.target);
+				#else
+					enqueue(&next_target.target);
+				#endif
 				break;
 
-				//	G2 - Arc Clockwise
-				// unimplemented
-
-				//	G3 - Arc Counter-clockwise
-				// unimplemented
+			#ifdef ARC_SUPPORT
+			case 2:
+			case 3:
+				//? --- G2: Clockwise Arc ---
+				//? --- G3: Counter-clockwise Arc ---
+				//?
+				//? Example: G2 X90.6 Y13.8 I5 J10 E22.4
+				//?
+				//? Go along an arc in the XY plane from the current point to (90.6, 13.8), around the center at 5 mm in X and 10 mm in Y from the current point. G2 goes clockwise, G3 counter-clockwise. Instead of I and J, R can give the radius, a negative radius chooses the arc longer than half a circle. Same start and end point with I and J makes a full circle. Z and E move linearly along the arc, so this can do helices as well.
+				//?
+				//? Only available with ARC_SUPPORT in config.h.
+				//?
+				if (next_target.seen_R) {
+					arc_center_from_radius(next_target.G == 3,
+					                       &next_target.I, &next_target.J);
+				}
+				else if ( ! next_target.seen_I && ! next_target.seen_J) {
+					sersendf_P(PSTR("E: G%d without I, J or R"), next_target.G);
+					break;
+				}
+				enqueue_arc(&next_target.target, next_target.I, next_target.J,
+				            next_target.G == 3);
+				break;
+			#endif
 
 			case 4:
 				//? --- G4: Dwell ---
@@ -139,14 +271,12 @@ void process_gcode_command() {
 				//?
 				//? In this case sit still doing nothing for 200 milliseconds.  During delays the state of the machine (for example the temperatures of its extruders) will still be preserved and controlled.
 				//?
-				queue_wait();
-				// delay
-				if (next_target.seen_P) {
-					for (;next_target.P > 0;next_target.P--) {
-						clock();
-						delay_ms(1);
-					}
-				}
+				//? The dwell gets queued like a move, so G-code processing goes on meanwhile. Without P, or with P0, wait for all moves to complete instead.
+				//?
+				if (next_target.seen_P && next_target.P)
+					enqueue_action(ACTION_DWELL, 0, next_target.P);
+				else
+					queue_wait();
 				break;
 
 			case 20:
@@ -192,36 +322,37 @@ void process_gcode_command() {
 				//?
 				//? will zero the X and Y axes, but not Z.  The actual coordinate values are ignored.
 				//?
-
-				queue_wait();
+        //? Homing gets queued like any other movement, so G-code processing
+        //? continues right away. X and Y search at the same time.
+				//?
 
 				if (next_target.seen_X) {
 					#if defined	X_MIN_PIN
-						home_x_negative();
-					#elif defined X_MAX_PIN
-						home_x_positive();
+						axisSelected |= HOME_X_NEGATIVE;
+					#else
+						axisSelected |= HOME_X_POSITIVE;
 					#endif
-					axisSelected = 1;
 				}
 				if (next_target.seen_Y) {
 					#if defined	Y_MIN_PIN
-						home_y_negative();
-					#elif defined Y_MAX_PIN
-						home_y_positive();
+						axisSelected |= HOME_Y_NEGATIVE;
+					#else
+						axisSelected |= HOME_Y_POSITIVE;
 					#endif
-					axisSelected = 1;
 				}
 				if (next_target.seen_Z) {
           #if defined Z_MIN_PIN
-            home_z_negative();
-          #elif defined Z_MAX_PIN
-            home_z_positive();
+            axisSelected |= HOME_Z_NEGATIVE;
+          #else
+            axisSelected |= HOME_Z_POSITIVE;
 					#endif
-					axisSelected = 1;
 				}
 				// there's no point in moving E, as E has no endstops
 
-				if (!axisSelected) {
+				if (axisSelected) {
+					home_search(axisSelected);
+				}
+				else {
 					home();
 				}
 				break;
@@ -298,18 +429,13 @@ void process_gcode_command() {
 				//?
 				//? Find the minimum limit of the specified axes by searching for the limit switch.
 				//?
-        #if defined X_MIN_PIN
-          if (next_target.seen_X)
-            home_x_negative();
-        #endif
-        #if defined Y_MIN_PIN
-          if (next_target.seen_Y)
-            home_y_negative();
-        #endif
-        #if defined Z_MIN_PIN
-          if (next_target.seen_Z)
-            home_z_negative();
-        #endif
+        if (next_target.seen_X)
+          axisSelected |= HOME_X_NEGATIVE;
+        if (next_target.seen_Y)
+          axisSelected |= HOME_Y_NEGATIVE;
+        if (next_target.seen_Z)
+          axisSelected |= HOME_Z_NEGATIVE;
+        home_search(axisSelected);
 				break;
 
 			case 162:
@@ -317,18 +443,13 @@ void process_gcode_command() {
 				//?
 				//? Find the maximum limit of the specified axes by searching for the limit switch.
 				//?
-        #if defined X_MAX_PIN
-          if (next_target.seen_X)
-            home_x_positive();
-        #endif
-        #if defined Y_MAX_PIN
-          if (next_target.seen_Y)
-            home_y_positive();
-        #endif
-        #if defined Z_MAX_PIN
-          if (next_target.seen_Z)
-            home_z_positive();
-        #endif
+        if (next_target.seen_X)
+          axisSelected |= HOME_X_POSITIVE;
+        if (next_target.seen_Y)
+          axisSelected |= HOME_Y_POSITIVE;
+        if (next_target.seen_Z)
+          axisSelected |= HOME_Z_POSITIVE;
+        home_search(axisSelected);
 				break;
 
 				// unknown gcode: spit an error
@@ -370,7 +491,7 @@ void process_gcode_command() {
 				//? --- M6: tool change ---
 				//?
 				//? Undocumented.
-				tool = next_tool;
+				tool_change(next_tool);
 				break;
 
 			case 82:
@@ -436,6 +557,9 @@ void process_gcode_command() {
         //? sensor index to address (e.g. M104 P1 S100 will set the temperature
         //? of the heater connected to the second temperature sensor rather
         //? than the extruder temperature).
+        //?
+        //? The new temperature gets queued, it applies when the moves
+        //? before are done.
         //?
 				if ( ! next_target.seen_S)
 					break;
@@ -444,7 +568,7 @@ void process_gcode_command() {
             next_target.P = HEATER_EXTRUDER;
         // else use the first available device
         #endif
-				temp_set(next_target.P, next_target.S);
+        enqueue_action(ACTION_TEMP, next_target.P, next_target.S);
 				break;
 
 			case 105:
@@ -480,11 +604,10 @@ void process_gcode_command() {
         //? Teacup supports an optional P parameter as a zero-based heater
         //? index to address. The heater index can differ from the temperature
         //? sensor index, see config.h.
+        //?
+        //? The change gets queued, it applies between the moves before and
+        //? after it, without slowing them down.
 
-				#ifdef ENFORCE_ORDER
-					// wait for all moves to complete
-					queue_wait();
-				#endif
         #ifdef HEATER_FAN
           if ( ! next_target.seen_P)
             next_target.P = HEATER_FAN;
@@ -492,7 +615,7 @@ void process_gcode_command() {
         #endif
 				if ( ! next_target.seen_S)
 					break;
-        heater_set(next_target.P, next_target.S);
+        enqueue_action(ACTION_HEATER, next_target.P, next_target.S);
 				break;
 
 			case 110:
@@ -594,10 +717,12 @@ void process_gcode_command() {
 				//? The details are returned to the host computer as key:value pairs separated by spaces and terminated with a linefeed.
 				//?
 				//? sample data from firmware:
-				//?  FIRMWARE_NAME:Teacup FIRMWARE_URL:http://github.com/traumflug/Teacup_Firmware/ PROTOCOL_VERSION:1.0 MACHINE_TYPE:Mendel EXTRUDER_COUNT:1 TEMP_SENSOR_COUNT:1 HEATER_COUNT:1
+				//?  FIRMWARE_NAME:Teacup FIRMWARE_URL:http://github.com/traumflug/Teacup_Firmware/ PROTOCOL_VERSION:1.0 MACHINE_TYPE:Mendel EXTRUDER_COUNT:2 TEMP_SENSOR_COUNT:3 HEATER_COUNT:3
+				//?
+				//? EXTRUDER_COUNT is EXTRUDERS from config.h, the number of tools T selects.
 				//?
 
-				sersendf_P(PSTR("FIRMWARE_NAME:Teacup FIRMWARE_URL:http://github.com/traumflug/Teacup_Firmware/ PROTOCOL_VERSION:1.0 MACHINE_TYPE:Mendel EXTRUDER_COUNT:%d TEMP_SENSOR_COUNT:%d HEATER_COUNT:%d"), 1, NUM_TEMP_SENSORS, NUM_HEATERS);
+				sersendf_P(PSTR("FIRMWARE_NAME:Teacup FIRMWARE_URL:http://github.com/traumflug/Teacup_Firmware/ PROTOCOL_VERSION:1.0 MACHINE_TYPE:Mendel EXTRUDER_COUNT:%d TEMP_SENSOR_COUNT:%d HEATER_COUNT:%d"), EXTRUDERS, NUM_TEMP_SENSORS, NUM_HEATERS);
 				// newline is sent from gcode_parse after we return
 				break;
 
@@ -730,10 +855,87 @@ void process_gcode_command() {
 				#ifdef	HEATER_BED
 					if ( ! next_target.seen_S)
 						break;
-					temp_set(HEATER_BED, next_target.S);
+					enqueue_action(ACTION_TEMP, HEATER_BED, next_target.S);
 				#endif
 				break;
 
+      case 220:
+        //? --- M220: set feed override ---
+        //? Example: M220 S80
+        //?
+        //? Run all movements at S percent of the feedrate requested, 10 to
+        //? 999. Axis speed limits still apply. Without S, the current value
+        //? is reported. Takes effect immediately, even for moves already
+        //? queued; with ACCELERATION_RAMPING, the move running accelerates
+        //? or decelerates to its new speed, too.
+        if (next_target.seen_S) {
+          if (next_target.S < 10)
+            next_target.S = 10;
+          else if (next_target.S > 999)
+            next_target.S = 999;
+          dda_set_feed_override(next_target.S);
+        }
+        else
+          sersendf_P(PSTR("S:%u%%"), feed_override);
+        break;
+
+      case 221:
+        //? --- M221: set flow override ---
+        //? Example: M221 S105
+        //?
+        //? Extrude S percent of the filament requested, 10 to 999. Without
+        //? S, the current value is reported. Applies to moves queued
+        //? afterwards, both with absolute and relative E.
+        if (next_target.seen_S) {
+          if (next_target.S < 10)
+            next_target.S = 10;
+          else if (next_target.S > 999)
+            next_target.S = 999;
+          flow_override = next_target.S;
+        }
+        else
+          sersendf_P(PSTR("S:%u%%"), flow_override);
+        break;
+
+      #ifdef QUEUE_STATISTICS
+      case 225:
+        //? --- M225: report movement queue statistics ---
+        //? Example: M225 S1
+        //?
+        //? Reports how full the movement queue was while moving, as a
+        //? histogram of moves waiting behind the current one, sampled every
+        //? clock tick, and how often it ran dry while moves kept coming in.
+        //? With LOOKAHEAD also the number of moves joined, of look-ahead
+        //? timeouts and average and minimum speed of the joins:
+        //?
+        //? <tt>Q:0/12/40/.../2051 U:3 J:1200 T:0 F:1650/420</tt>
+        //?
+        //? An empty queue with underruns means the host or the serial line
+        //? is too slow, a full queue with slow joins means the planner
+        //? limits, look-ahead timeouts mean the CPU is too busy. With S1,
+        //? counting starts anew after reporting. Requires QUEUE_STATISTICS
+        //? in config.h.
+        print_queue_statistics(next_target.seen_S && next_target.S);
+        break;
+      #endif
+
+      #ifdef PRESSURE_ADVANCE
+      case 233:
+        //? --- M233: set pressure advance factor ---
+        //? Example: M233 S0.05
+        //?
+        //? Set the factor K of pressure advance, in seconds. The extruder
+        //? gets advanced by K times its speed, see PRESSURE_ADVANCE in
+        //? config.h. S0 turns pressure advance off. Without S, the current
+        //? value is reported. Takes effect immediately, even for moves
+        //? already queued.
+        if (next_target.seen_S)
+          advance_k = next_target.S;
+        else
+          sersendf_P(PSTR("K:%u ms"), advance_k);
+        break;
+      #endif
+
 			#ifdef	DEBUG
 			case 240:
 				//? --- M240: echo off ---
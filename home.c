@@ -9,6 +9,7 @@
 #include	"dda_queue.h"
 #include	"pinio.h"
 #include	"gcode_parse.h"
+#include	"dda_maths.h"
 
 // Check configuration.
 #if defined X_MIN_PIN || defined X_MAX_PIN
@@ -42,202 +43,233 @@
 //   units: / 1000 for um -> mm; * 60 for mm/s -> mm/min
 #ifdef ENDSTOP_CLEARANCE_X
   #define SEARCH_FAST_X (uint32_t)((double)60. * \
-            sqrt((double)2 * ACCELERATION * ENDSTOP_CLEARANCE_X / 1000.))
+            sqrt((double)2 * ACCELERATION_X * ENDSTOP_CLEARANCE_X / 1000.))
 #endif
 #ifdef ENDSTOP_CLEARANCE_Y
   #define SEARCH_FAST_Y (uint32_t)((double)60. * \
-            sqrt((double)2 * ACCELERATION * ENDSTOP_CLEARANCE_Y / 1000.))
+            sqrt((double)2 * ACCELERATION_Y * ENDSTOP_CLEARANCE_Y / 1000.))
 #endif
 #ifdef ENDSTOP_CLEARANCE_Z
   #define SEARCH_FAST_Z (uint32_t)((double)60. * \
-            sqrt((double)2 * ACCELERATION * ENDSTOP_CLEARANCE_Z / 1000.))
+            sqrt((double)2 * ACCELERATION_Z * ENDSTOP_CLEARANCE_Z / 1000.))
 #endif
 
+#ifdef X_MIN_PIN
+  #define HOME_X_MIN HOME_X_NEGATIVE
+#else
+  #define HOME_X_MIN 0
+#endif
+#ifdef X_MIN
+  #define HOME_POS_X_MIN (int32_t)(X_MIN * 1000.)
+#else
+  #define HOME_POS_X_MIN 0
+#endif
+#if defined X_MAX_PIN && ! defined X_MAX
+  #warning X_MAX_PIN defined, but not X_MAX. Homing to X max disabled.
+#endif
+#if defined X_MAX_PIN && defined X_MAX
+  #define HOME_X_MAX HOME_X_POSITIVE
+  #define HOME_POS_X_MAX (int32_t)(X_MAX * 1000.)
+#else
+  #define HOME_X_MAX 0
+  #define HOME_POS_X_MAX 0
+#endif
+#if defined X_MIN_PIN || defined X_MAX_PIN
+  #define HOME_FAST_X ((SEARCH_FAST_X > SEARCH_FEEDRATE_X) ? \
+                       SEARCH_FAST_X : SEARCH_FEEDRATE_X)
+  #define HOME_SLOW_X SEARCH_FEEDRATE_X
+#else
+  #define HOME_FAST_X 0
+  #define HOME_SLOW_X 0
+#endif
 
-/// home all 3 axes
-void home() {
-
-  home_x_negative();
-  home_x_positive();
-
-  home_y_negative();
-  home_y_positive();
+#ifdef Y_MIN_PIN
+  #define HOME_Y_MIN HOME_Y_NEGATIVE
+#else
+  #define HOME_Y_MIN 0
+#endif
+#ifdef Y_MIN
+  #define HOME_POS_Y_MIN (int32_t)(Y_MIN * 1000.)
+#else
+  #define HOME_POS_Y_MIN 0
+#endif
+#if defined Y_MAX_PIN && ! defined Y_MAX
+  #warning Y_MAX_PIN defined, but not Y_MAX. Homing to Y max disabled.
+#endif
+#if defined Y_MAX_PIN && defined Y_MAX
+  #define HOME_Y_MAX HOME_Y_POSITIVE
+  #define HOME_POS_Y_MAX (int32_t)(Y_MAX * 1000.)
+#else
+  #define HOME_Y_MAX 0
+  #define HOME_POS_Y_MAX 0
+#endif
+#if defined Y_MIN_PIN || defined Y_MAX_PIN
+  #define HOME_FAST_Y ((SEARCH_FAST_Y > SEARCH_FEEDRATE_Y) ? \
+                       SEARCH_FAST_Y : SEARCH_FEEDRATE_Y)
+  #define HOME_SLOW_Y SEARCH_FEEDRATE_Y
+#else
+  #define HOME_FAST_Y 0
+  #define HOME_SLOW_Y 0
+#endif
 
-  home_z_negative();
-  home_z_positive();
-}
+#ifdef Z_MIN_PIN
+  #define HOME_Z_MIN HOME_Z_NEGATIVE
+#else
+  #define HOME_Z_MIN 0
+#endif
+#ifdef Z_MIN
+  #define HOME_POS_Z_MIN (int32_t)(Z_MIN * 1000.)
+#else
+  #define HOME_POS_Z_MIN 0
+#endif
+#if defined Z_MAX_PIN && ! defined Z_MAX
+  #warning Z_MAX_PIN defined, but not Z_MAX. Homing to Z max disabled.
+#endif
+#if defined Z_MAX_PIN && defined Z_MAX
+  #define HOME_Z_MAX HOME_Z_POSITIVE
+  #define HOME_POS_Z_MAX (int32_t)(Z_MAX * 1000.)
+#else
+  #define HOME_Z_MAX 0
+  #define HOME_POS_Z_MAX 0
+#endif
+#if defined Z_MIN_PIN || defined Z_MAX_PIN
+  #define HOME_FAST_Z ((SEARCH_FAST_Z > SEARCH_FEEDRATE_Z) ? \
+                       SEARCH_FAST_Z : SEARCH_FEEDRATE_Z)
+  #define HOME_SLOW_Z SEARCH_FEEDRATE_Z
+#else
+  #define HOME_FAST_Z 0
+  #define HOME_SLOW_Z 0
+#endif
 
-/// find X MIN endstop
-void home_x_negative() {
-	#if defined X_MIN_PIN
-		TARGET t = startpoint;
-
-    t.axis[X] = -1000000;
-    if (SEARCH_FAST_X > SEARCH_FEEDRATE_X) // Preprocessor can't check this :-/
-      t.F = SEARCH_FAST_X;
-    else
-      t.F = SEARCH_FEEDRATE_X;
-    enqueue_home(&t, 0x01, 1);
-
-    if (SEARCH_FAST_X > SEARCH_FEEDRATE_X) {
-			// back off slowly
-      t.axis[X] = +1000000;
-			t.F = SEARCH_FEEDRATE_X;
-      enqueue_home(&t, 0x01, 0);
+/// Endstops available for homing.
+#define HOME_ENDSTOPS (HOME_X_MIN | HOME_X_MAX | HOME_Y_MIN | HOME_Y_MAX | \
+                       HOME_Z_MIN | HOME_Z_MAX)
+
+/// Feedrate towards the endstop, in mm/min.
+static const axes_uint32_t PROGMEM home_fast_P = {
+  HOME_FAST_X, HOME_FAST_Y, HOME_FAST_Z, 0
+};
+
+/// Feedrate backing off the endstop, in mm/min.
+static const axes_uint32_t PROGMEM home_slow_P = {
+  HOME_SLOW_X, HOME_SLOW_Y, HOME_SLOW_Z, 0
+};
+
+/// Position at the min endstop, in um.
+static const axes_int32_t PROGMEM home_min_P = {
+  HOME_POS_X_MIN, HOME_POS_Y_MIN, HOME_POS_Z_MIN, 0
+};
+
+/// Position at the max endstop, in um.
+static const axes_int32_t PROGMEM home_max_P = {
+  HOME_POS_X_MAX, HOME_POS_Y_MAX, HOME_POS_Z_MAX, 0
+};
+
+/*! Queue endstop search moves for several axes at once.
+  \param endstops the endstops to search, one per axis at most
+  \param search 1 to search towards the endstops, 0 to back off slowly
+
+  Each axis moves at its own feedrate, so distances are scaled accordingly.
+  The first endstop triggering (or releasing) stops the move, so there's one
+  move per axis. Axes already at their endstop don't move in the follow-up
+  moves, see dda_start().
+*/
+static void home_phase(uint8_t endstops, uint8_t search) {
+  TARGET t = startpoint;
+  axes_uint32_t speed;
+  axes_int32_t delta;
+  uint32_t slowest = 0;
+  uint8_t moves = 0;
+  enum axis_e i;
+
+  for (i = X; i < E; i++) {
+    speed[i] = 0;
+    if (endstops & (0x03 << (i * 2))) {
+      speed[i] = pgm_read_dword(search ? &home_fast_P[i] : &home_slow_P[i]);
+      if (slowest == 0 || speed[i] < slowest)
+        slowest = speed[i];
+      moves++;
     }
-
-		// set X home
-		queue_wait(); // we have to wait here, see G92
-		#ifdef X_MIN
-      startpoint.axis[X] = next_target.target.axis[X] = (int32_t)(X_MIN * 1000.0);
-		#else
-      startpoint.axis[X] = next_target.target.axis[X] = 0;
-		#endif
-		dda_new_startpoint();
-	#endif
+  }
+  if (moves == 0)
+    return;
+
+  for (i = X; i < E; i++) {
+    delta[i] = muldiv(1000000, speed[i], slowest);
+    // Towards a min endstop is negative, backing off from it positive.
+    if (((endstops >> (i * 2)) & 0x01) ? search : ! search)
+      delta[i] = -delta[i];
+  }
+  // Same distance approximation as dda_create(), so each axis gets its speed.
+  if (speed[Z])
+    t.F = speed[Z];
+  else
+    t.F = approx_distance(speed[X], speed[Y]);
+  if (t.e_relative)
+    t.axis[E] = 0;
+
+  for ( ; moves; moves--) {
+    for (i = X; i < E; i++)
+      t.axis[i] += delta[i];
+    enqueue_home(&t, endstops, search);
+  }
 }
 
-/// find X_MAX endstop
-void home_x_positive() {
-	#if defined X_MAX_PIN && ! defined X_MAX
-		#warning X_MAX_PIN defined, but not X_MAX. home_x_positive() disabled.
-	#endif
-	#if defined X_MAX_PIN && defined X_MAX
-		TARGET t = startpoint;
-
-    t.axis[X] = +1000000;
-    if (SEARCH_FAST_X > SEARCH_FEEDRATE_X)
-      t.F = SEARCH_FAST_X;
-    else
-      t.F = SEARCH_FEEDRATE_X;
-    enqueue_home(&t, 0x02, 1);
-
-    if (SEARCH_FAST_X > SEARCH_FEEDRATE_X) {
-      t.axis[X] = -1000000;
-			t.F = SEARCH_FEEDRATE_X;
-      enqueue_home(&t, 0x02, 0);
-    }
+/*! Find endstops, several axes at the same time.
+  \param endstops the endstops to search, one per axis at most
 
-		// set X home
-		queue_wait();
-		// set position to MAX
-    startpoint.axis[X] = next_target.target.axis[X] = (int32_t)(X_MAX * 1000.);
-		dda_new_startpoint();
-	#endif
+  All this is queued, nothing waits for the movement to finish. Instead the
+  new position is set right away, so following moves get planned from there.
+  Endstop searches don't join with other moves, see dda_create().
+*/
+static void home_axes(uint8_t endstops) {
+  uint8_t slow = 0;
+  enum axis_e i;
+
+  if (endstops == 0)
+    return;
+
+  home_phase(endstops, 1);
+
+  for (i = X; i < E; i++)
+    if ((endstops & (0x03 << (i * 2))) &&
+        pgm_read_dword(&home_fast_P[i]) > pgm_read_dword(&home_slow_P[i]))
+      slow |= endstops & (0x03 << (i * 2));
+  home_phase(slow, 0);
+
+  for (i = X; i < E; i++) {
+    if (endstops & (0x01 << (i * 2)))
+      startpoint.axis[i] = next_target.target.axis[i] =
+        (int32_t)pgm_read_dword(&home_min_P[i]);
+    else if (endstops & (0x02 << (i * 2)))
+      startpoint.axis[i] = next_target.target.axis[i] =
+        (int32_t)pgm_read_dword(&home_max_P[i]);
+  }
+  dda_new_startpoint();
 }
 
-/// fund Y MIN endstop
-void home_y_negative() {
-	#if defined Y_MIN_PIN
-		TARGET t = startpoint;
-
-    t.axis[Y] = -1000000;
-    if (SEARCH_FAST_Y > SEARCH_FEEDRATE_Y)
-      t.F = SEARCH_FAST_Y;
-    else
-      t.F = SEARCH_FEEDRATE_Y;
-    enqueue_home(&t, 0x04, 1);
-
-    if (SEARCH_FAST_Y > SEARCH_FEEDRATE_Y) {
-      t.axis[Y] = +1000000;
-			t.F = SEARCH_FEEDRATE_Y;
-      enqueue_home(&t, 0x04, 0);
-    }
-
-		// set Y home
-		queue_wait();
-		#ifdef	Y_MIN
-      startpoint.axis[Y] = next_target.target.axis[Y] = (int32_t)(Y_MIN * 1000.);
-		#else
-      startpoint.axis[Y] = next_target.target.axis[Y] = 0;
-		#endif
-		dda_new_startpoint();
-	#endif
+/// home all 3 axes
+void home() {
+  home_search(HOME_ENDSTOPS);
 }
 
-/// find Y MAX endstop
-void home_y_positive() {
-	#if defined Y_MAX_PIN && ! defined Y_MAX
-		#warning Y_MAX_PIN defined, but not Y_MAX. home_y_positive() disabled.
-	#endif
-	#if defined Y_MAX_PIN && defined Y_MAX
-		TARGET t = startpoint;
-
-    t.axis[Y] = +1000000;
-    if (SEARCH_FAST_Y > SEARCH_FEEDRATE_Y)
-      t.F = SEARCH_FAST_Y;
-    else
-      t.F = SEARCH_FEEDRATE_Y;
-    enqueue_home(&t, 0x08, 1);
-
-    if (SEARCH_FAST_Y > SEARCH_FEEDRATE_Y) {
-      t.axis[Y] = -1000000;
-			t.F = SEARCH_FEEDRATE_Y;
-      enqueue_home(&t, 0x08, 0);
-    }
-
-		// set Y home
-		queue_wait();
-		// set position to MAX
-    startpoint.axis[Y] = next_target.target.axis[Y] = (int32_t)(Y_MAX * 1000.);
-		dda_new_startpoint();
-	#endif
-}
+/*! Find endstops.
+  \param endstops the endstops to search, see HOME_X_NEGATIVE and friends
 
-/// find Z MIN endstop
-void home_z_negative() {
-	#if defined Z_MIN_PIN
-		TARGET t = startpoint;
-
-    t.axis[Z] = -1000000;
-    if (SEARCH_FAST_Z > SEARCH_FEEDRATE_Z)
-      t.F = SEARCH_FAST_Z;
-    else
-      t.F = SEARCH_FEEDRATE_Z;
-    enqueue_home(&t, 0x10, 1);
-
-    if (SEARCH_FAST_Z > SEARCH_FEEDRATE_Z) {
-      t.axis[Z] = +1000000;
-			t.F = SEARCH_FEEDRATE_Z;
-      enqueue_home(&t, 0x10, 0);
-    }
+  X and Y search at the same time, Z afterwards. Min endstops are searched
+  before max endstops. Endstops not available are ignored.
+*/
+void home_search(uint8_t endstops) {
+  uint8_t first;
 
-		// set Z home
-		queue_wait();
-		#ifdef Z_MIN
-      startpoint.axis[Z] = next_target.target.axis[Z] = (int32_t)(Z_MIN * 1000.);
-		#else
-      startpoint.axis[Z] = next_target.target.axis[Z] = 0;
-		#endif
-		dda_new_startpoint();
-	#endif
-}
+  endstops &= HOME_ENDSTOPS;
 
-/// find Z MAX endstop
-void home_z_positive() {
-	#if defined Z_MAX_PIN && ! defined Z_MAX
-		#warning Z_MAX_PIN defined, but not Z_MAX. home_z_positive() disabled.
-	#endif
-	#if defined Z_MAX_PIN && defined Z_MAX
-		TARGET t = startpoint;
-
-    t.axis[Z] = +1000000;
-    if (SEARCH_FAST_Z > SEARCH_FEEDRATE_Z)
-      t.F = SEARCH_FAST_Z;
-    else
-      t.F = SEARCH_FEEDRATE_Z;
-    enqueue_home(&t, 0x20, 1);
-
-    if (SEARCH_FAST_Z > SEARCH_FEEDRATE_Z) {
-      t.axis[Z] = -1000000;
-			t.F = SEARCH_FEEDRATE_Z;
-      enqueue_home(&t, 0x20, 0);
-    }
+  // Min endstops, plus max endstops of axes without a min one.
+  first = endstops & (HOME_X_NEGATIVE | HOME_Y_NEGATIVE | HOME_Z_NEGATIVE);
+  first |= endstops & ~(first << 1);
 
-		// set Z home
-		queue_wait();
-		// set position to MAX
-    startpoint.axis[Z] = next_target.target.axis[Z] = (int32_t)(Z_MAX * 1000.);
-		dda_new_startpoint();
-	#endif
+  home_axes(first & 0x0F);
+  home_axes(endstops & ~first & 0x0F);
+  home_axes(first & 0x30);
+  home_axes(endstops & ~first & 0x30);
 }
@@ -1,13 +1,18 @@
 #ifndef	_HOME_H
 #define _HOME_H
 
+#include	<stdint.h>
+
+/// Endstops to search, same bits as dda->endstop_check.
+#define	HOME_X_NEGATIVE		0x01
+#define	HOME_X_POSITIVE		0x02
+#define	HOME_Y_NEGATIVE		0x04
+#define	HOME_Y_POSITIVE		0x08
+#define	HOME_Z_NEGATIVE		0x10
+#define	HOME_Z_POSITIVE		0x20
+
 void home(void);
 
-void home_x_negative(void);
-void home_x_positive(void);
-void home_y_negative(void);
-void home_y_positive(void);
-void home_z_negative(void);
-void home_z_positive(void);
+void home_search(uint8_t endstops);
 
 #endif	/* _HOME_H */
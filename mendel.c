@@ -124,6 +124,14 @@ void io_init(void) {
 		WRITE(E_STEP_PIN, 0);	SET_OUTPUT(E_STEP_PIN);
 		WRITE(E_DIR_PIN,  0);	SET_OUTPUT(E_DIR_PIN);
 	#endif
+	#if EXTRUDERS > 1 && defined E1_STEP_PIN && defined E1_DIR_PIN
+		WRITE(E1_STEP_PIN, 0);	SET_OUTPUT(E1_STEP_PIN);
+		WRITE(E1_DIR_PIN,  0);	SET_OUTPUT(E1_DIR_PIN);
+	#endif
+	#if EXTRUDERS > 2 && defined E2_STEP_PIN && defined E2_DIR_PIN
+		WRITE(E2_STEP_PIN, 0);	SET_OUTPUT(E2_STEP_PIN);
+		WRITE(E2_DIR_PIN,  0);	SET_OUTPUT(E2_DIR_PIN);
+	#endif
 
 	// Common Stepper Enable
 	#ifdef STEPPER_ENABLE_PIN
@@ -175,6 +183,26 @@ void io_init(void) {
 		SET_OUTPUT(E_ENABLE_PIN);
 	#endif
 
+	// E1 Stepper Enable
+	#if EXTRUDERS > 1 && defined E1_ENABLE_PIN
+		#ifdef E1_INVERT_ENABLE
+			WRITE(E1_ENABLE_PIN, 0);
+		#else
+			WRITE(E1_ENABLE_PIN, 1);
+		#endif
+		SET_OUTPUT(E1_ENABLE_PIN);
+	#endif
+
+	// E2 Stepper Enable
+	#if EXTRUDERS > 2 && defined E2_ENABLE_PIN
+		#ifdef E2_INVERT_ENABLE
+			WRITE(E2_ENABLE_PIN, 0);
+		#else
+			WRITE(E2_ENABLE_PIN, 1);
+		#endif
+		SET_OUTPUT(E2_ENABLE_PIN);
+	#endif
+
 	#ifdef	STEPPER_ENABLE_PIN
 		power_off();
 	#endif
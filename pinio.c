@@ -31,6 +31,8 @@ void power_off() {
 	y_disable();
 	z_disable();
 	e_disable();
+	e1_disable();
+	e2_disable();
 
 	#ifdef	PS_ON_PIN
 		SET_INPUT(PS_ON_PIN);
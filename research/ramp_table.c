@@ -0,0 +1,124 @@
+/** \file
+  \brief Compare acceleration ramp step delay calculations on the host.
+
+  Compares c0 * int_inv_sqrt(n) >> 13 with the table based ramp_table_c(),
+  see RAMP_LOOKUP_TABLE. Both are copies of the code in dda_maths.c, with
+  the table calculated by the math library instead of the preprocessor.
+
+  Reports deviations from the exact value, c0 / (2 * sqrt(n)), and run time
+  per call. Run time on the host gives a ratio only, for cycle counts on the
+  AVR use testcases/run-in-simulavr.sh.
+
+  Build and run:
+
+    gcc -O2 -o ramp_table ramp_table.c -lm && ./ramp_table
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+
+#define C0 98541UL    // X axis with 1000 mm/s^2 and 80 steps/mm @ 16 MHz
+#define N_MAX 65535   // Beyond that, int_inv_sqrt() doesn't work.
+#define RUNS 200
+
+uint16_t int_inv_sqrt(uint16_t a) {
+  uint8_t z = 0, i;
+  uint16_t x, j;
+  uint32_t q = ((uint32_t)(0xFFFFU / a)) << 8;
+
+  for (i = 0x80; i; i >>= 1) {
+    uint16_t y;
+
+    z |= i;
+    y = (uint16_t)z * z;
+    if (y > (q >> 8))
+      z ^= i;
+  }
+
+  x = z << 4;
+  for (j = 0x8; j; j >>= 1) {
+    uint32_t y;
+
+    x |= j;
+    y = (uint32_t)x * x;
+    if (y > q)
+      x ^= j;
+  }
+
+  return x;
+}
+
+static uint16_t ramp_table_P[49];
+
+uint32_t ramp_table_c(uint32_t c0, uint32_t n) {
+  uint8_t shift = 8;
+  uint16_t t, t1;
+  uint32_t c;
+
+  while (n < 0x4000) {
+    n <<= 2;
+    shift--;
+  }
+  while (n > 0xFFFF) {
+    n >>= 2;
+    shift++;
+  }
+
+  t = ramp_table_P[(n >> 10) - 16];
+  t1 = ramp_table_P[(n >> 10) - 15];
+  t -= ((uint32_t)(t - t1) * (n & 0x3FF)) >> 10;
+
+  c = (c0 >> 16) * t + (((c0 & 0xFFFF) * t) >> 16);
+
+  return c >> shift;
+}
+
+static double now_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void report(const char *name, uint32_t (*f)(uint32_t, uint32_t)) {
+  double err, max_err = 0., sum_err = 0., t;
+  volatile uint32_t sink = 0;
+  uint32_t n, max_n = 0, r;
+
+  for (n = 1; n <= N_MAX; n++) {
+    err = fabs(f(C0, n) / (C0 / (2. * sqrt(n))) - 1.);
+    sum_err += err;
+    if (err > max_err) {
+      max_err = err;
+      max_n = n;
+    }
+  }
+
+  t = now_ns();
+  for (r = 0; r < RUNS; r++)
+    for (n = 1; n <= N_MAX; n++)
+      sink += f(C0, n);
+  t = (now_ns() - t) / ((double)RUNS * N_MAX);
+
+  printf("%-16s max error %7.4f %% (n = %5u), mean error %7.4f %%, "
+         "%5.2f ns per call\n", name, max_err * 100., max_n,
+         sum_err / N_MAX * 100., t);
+}
+
+static uint32_t formula_c(uint32_t c0, uint32_t n) {
+  return (c0 * int_inv_sqrt(n)) >> 13;
+}
+
+int main(void) {
+  int i;
+
+  for (i = 0; i < 49; i++)
+    ramp_table_P[i] = (uint16_t)(262140. / sqrt(16. + i) + .5);
+
+  report("int_inv_sqrt()", formula_c);
+  report("ramp_table_c()", ramp_table_c);
+
+  return 0;
+}
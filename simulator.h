@@ -2,28 +2,54 @@
 
 #undef X_STEP_PIN
 #undef X_DIR_PIN
-#undef X_MIN_PIN
 #undef X_ENABLE_PIN
 #undef Y_STEP_PIN
 #undef Y_DIR_PIN
-#undef Y_MIN_PIN
 #undef Y_ENABLE_PIN
 #undef Z_STEP_PIN
 #undef Z_DIR_PIN
-#undef Z_MIN_PIN
 #undef Z_ENABLE_PIN
 #undef E_STEP_PIN
 #undef E_DIR_PIN
 #undef E_ENABLE_PIN
+#undef E1_STEP_PIN
+#undef E1_DIR_PIN
+#undef E1_ENABLE_PIN
+#undef E2_STEP_PIN
+#undef E2_DIR_PIN
+#undef E2_ENABLE_PIN
 #undef STEPPER_ENABLE_PIN
 
 #undef PS_MOSFET_PIN
 #undef PS_ON_PIN
 #undef RX_ENABLE_PIN
 #undef TX_ENABLE_PIN
-#undef X_MAX_PIN
-#undef Y_MAX_PIN
-#undef Z_MAX_PIN
+
+// Endstops stay as configured, but read simulator pins, see --endstop.
+#ifdef X_MIN_PIN
+  #undef X_MIN_PIN
+  #define X_MIN_PIN X_MIN_PIN
+#endif
+#ifdef X_MAX_PIN
+  #undef X_MAX_PIN
+  #define X_MAX_PIN X_MAX_PIN
+#endif
+#ifdef Y_MIN_PIN
+  #undef Y_MIN_PIN
+  #define Y_MIN_PIN Y_MIN_PIN
+#endif
+#ifdef Y_MAX_PIN
+  #undef Y_MAX_PIN
+  #define Y_MAX_PIN Y_MAX_PIN
+#endif
+#ifdef Z_MIN_PIN
+  #undef Z_MIN_PIN
+  #define Z_MIN_PIN Z_MIN_PIN
+#endif
+#ifdef Z_MAX_PIN
+  #undef Z_MAX_PIN
+  #define Z_MAX_PIN Z_MAX_PIN
+#endif
 
 #undef READ
 #undef WRITE
@@ -88,6 +114,9 @@ typedef enum {
   E_STEP_PIN,
   E_DIR_PIN,
   E_ENABLE_PIN,
+  X_MAX_PIN,
+  Y_MAX_PIN,
+  Z_MAX_PIN,
 
   STEPPER_ENABLE_PIN,
 
@@ -102,9 +131,6 @@ typedef enum {
  * Not used in the simulator.  Add them to this list to enable them if needed.
   PS_MOSFET_PIN,
   PS_ON_PIN,
-  X_MAX_PIN,
-  Y_MAX_PIN,
-  Z_MAX_PIN,
 */
   PIN_NB  /* End of PINS marker; Put all new pins before this one */
 } pin_t;
@@ -138,6 +164,7 @@ void SET_INPUT(pin_t pin);
 #define ISR(fn) void fn (void)
 void TIMER1_COMPA_vect(void);
 void TIMER1_COMPB_vect(void);
+void PCINT0_vect(void);
 
 // Compare-timers for next interrupts.
 extern uint16_t OCR1A, OCR1B;
@@ -162,6 +189,8 @@ void sim_error(const char msg[]);
 void sim_assert(bool cond, const char msg[]);
 void sim_gcode_ch(char ch);
 void sim_gcode(const char msg[]);
+bool sim_pcint_enable(pin_t pin); ///< enable the pin change interrupt of a pin
+void sim_pcint_isr(void); ///< run the pin change interrupt, if a pin changed
 
 /**
  * Initialize simulator timer and set time scale.
@@ -175,6 +204,8 @@ void sim_setTimer(void);
 uint16_t sim_tick_counter(void);
 uint64_t sim_runtime_ns(void); ///< Simulated run-time in nanoseconds
 void sim_time_warp(void); ///< skip ahead to next timer interrupt, when time_scale==0
+void sim_step_isr_begin(void); ///< step interrupt starts, for statistics
+void sim_step_isr_end(void);   ///< step interrupt done, for statistics
 
 #define DIO0_PIN "proof of life"
 
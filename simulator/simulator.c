@@ -3,10 +3,13 @@
 #include <stdarg.h>
 #include <ctype.h>
 #include <getopt.h>
+#include <string.h>
+#include <limits.h>
 
 // If no time scale specified, use 1/10th real-time for simulator
 #define DEFAULT_TIME_SCALE 10
 
+#include "config_wrapper.h"
 #include "simulator.h"
 #include "data_recorder.h"
 
@@ -43,14 +46,15 @@ int verbose = 1;                ///< 0=quiet, 1=normal, 2=noisy, 3=debug, etc.
 int trace_gcode = 0;            ///< show gcode on the console
 int trace_pos = 0;              ///< show print head position on the console
 
-const char * shortopts = "qgpvt:o::";
+const char * shortopts = "qgpvt:o::e:";
 struct option opts[] = {
   { "quiet", no_argument, &verbose , 0 },
   { "verbose", no_argument, NULL, 'v' },
   { "gcode", no_argument, NULL, 'g' },
   { "pos", no_argument, NULL, 'p' },
   { "time-scale", required_argument, NULL, 't' },
-  { "tracefile", optional_argument, NULL, 'o' }
+  { "tracefile", optional_argument, NULL, 'o' },
+  { "endstop", required_argument, NULL, 'e' }
 };
 
 static void usage(const char *name) {
@@ -62,10 +66,19 @@ static void usage(const char *name) {
   printf("   -p || --pos                   show head position on console\n");
   printf("   -t || --time-scale=n          set time-scale; 0=warp-speed, 1=real-time, 2=half-time, etc.\n");
   printf("   -o || --tracefile[=filename]  write simulator pin trace to 'outfile' (default filename=datalog.out)\n");
+  printf("   -e || --endstop=xmin:n[:b]    X min endstop triggers at n steps and below, bouncing\n");
+  printf("                                 on every other step for b steps before, likewise\n");
+  printf("                                 xmax (n and above), ymin, ymax, zmin and zmax.\n");
+  printf("                                 Default: X_MIN and X_MAX from config.h, 0 without X_MIN.\n");
   printf("\n");
   exit(1);
 }
 
+static void report_step_stats(void);
+static void sim_endstop_init(void);
+static void sim_endstop_script(const char *arg);
+static void sim_endstop_update(int axis);
+
 int g_argc;
 char** g_argv;
 void sim_start(int argc, char** argv) {
@@ -73,6 +86,7 @@ void sim_start(int argc, char** argv) {
   int index;
   uint8_t time_scale = DEFAULT_TIME_SCALE;
 
+  sim_endstop_init();
   while ((c = getopt_long (argc, argv, shortopts, opts, &index)) != -1)
     switch (c) {
     case 'q':
@@ -93,6 +107,9 @@ void sim_start(int argc, char** argv) {
     case 'o':
       recorder_init(optarg ? optarg : "datalog.out");
       break;
+    case 'e':
+      sim_endstop_script(optarg);
+      break;
     default:
       sim_error("Unexpected result in getopt_long handler");
     }
@@ -138,8 +155,19 @@ void sim_start(int argc, char** argv) {
   NAME_PIN(E_STEP_PIN);
   NAME_PIN(E_DIR_PIN);
   NAME_PIN(E_ENABLE_PIN);
+  NAME_PIN(X_MAX_PIN);
+  NAME_PIN(Y_MAX_PIN);
+  NAME_PIN(Z_MAX_PIN);
 
   NAME_PIN(STEPPER_ENABLE_PIN);
+
+  // Endstop pins according to the start position.
+  for (index = 0; index < AXES; index++)
+    sim_endstop_update(index);
+
+  // Report step statistics when done. After recorder_init(), so this runs
+  // before the datalog gets closed.
+  atexit(report_step_stats);
 }
 
 /* -- debugging ------------------------------------------------------------ */
@@ -274,6 +302,63 @@ void cli(void) {
 #define MAX_IDLE_TIME_NS (2*1000*1000*1000)
 #define NS_PER_SEC       (1000*1000*1000)  // Token for "1 billion"
 
+/* -- step statistics ---------------------------------------------------- */
+
+/** Time window (ns) for measuring peak step and step interrupt rates. */
+#define STATS_WINDOW_NS (10*1000*1000)
+
+static uint32_t steps_total;          ///< Steps done, all axes
+static uint32_t step_isrs_total;      ///< Step interrupts doing steps
+static uint32_t steps_window, step_isrs_window;
+static uint32_t steps_peak, step_isrs_peak;  ///< Per second
+static uint64_t window_start;
+static uint32_t steps_at_isr_begin;
+
+void sim_step_isr_begin(void) {
+  steps_at_isr_begin = steps_total;
+}
+
+/** Count step interrupts which actually did a step. Interrupts only
+ *  extending a long step delay don't count. */
+void sim_step_isr_end(void) {
+  uint64_t now = sim_runtime_ns();
+
+  if (steps_total != steps_at_isr_begin) {
+    step_isrs_total++;
+    step_isrs_window++;
+  }
+
+  if (now - window_start >= STATS_WINDOW_NS) {
+    uint64_t rate;
+
+    rate = (uint64_t)steps_window * NS_PER_SEC / (now - window_start);
+    if (rate > steps_peak)
+      steps_peak = rate;
+    rate = (uint64_t)step_isrs_window * NS_PER_SEC / (now - window_start);
+    if (rate > step_isrs_peak)
+      step_isrs_peak = rate;
+    steps_window = step_isrs_window = 0;
+    window_start = now;
+  }
+}
+
+/** Steps per step interrupt show how much step batching (STEP_BATCH_RATE)
+ *  saves. */
+static void report_step_stats(void) {
+  char msg[120];
+  uint32_t ratio = step_isrs_total ? steps_total * 100 / step_isrs_total : 0;
+
+  snprintf(msg, sizeof(msg), "Steps: %u in %u step interrupts, "
+           "%u.%02u steps per interrupt.", steps_total, step_isrs_total,
+           ratio / 100, ratio % 100);
+  sim_info("%s", msg);
+  record_comment(msg);
+  snprintf(msg, sizeof(msg), "Peak rates: %u steps/s, %u step interrupts/s.",
+           steps_peak, step_isrs_peak);
+  sim_info("%s", msg);
+  record_comment(msg);
+}
+
 /* -- PIN I/O ------------------------------------------------------------ */
 
 #define out true
@@ -370,9 +455,12 @@ void WRITE(pin_t pin, bool s) {
       break;
     }
     if ( axis != AXIS_NONE ) {
+      steps_total++;
+      steps_window++;
       pos[axis] += dir;
       record_pin(TRACE_POS + axis, pos[axis], nseconds);
       print_pos();
+      sim_endstop_update(axis);
     }
   }
 }
@@ -386,3 +474,153 @@ void SET_INPUT(pin_t pin) {
   sim_assert(pin < PIN_NB, "Pin number out of range");
   direction[pin] = in;
 }
+
+/* -- endstops ---------------------------------------------------------- */
+
+/** Simulated endstops, in the order of dda->endstop_check bits. A min
+ *  endstop is triggered at its position and below, a max endstop at its
+ *  position and above. Before that, it can bounce for some steps. */
+static struct {
+  bool used;        ///< configured in config.h
+  bool pcint;       ///< pin change interrupt enabled, see sim_pcint_enable()
+  bool inverted;    ///< X_INVERT_MIN and friends
+  int pos;          ///< trigger position, in steps
+  int bounce;       ///< steps bouncing before the trigger position
+} endstop[6];
+
+static const pin_t endstop_pin[6] = {
+  X_MIN_PIN, X_MAX_PIN, Y_MIN_PIN, Y_MAX_PIN, Z_MIN_PIN, Z_MAX_PIN
+};
+
+static bool pcint_pending;
+
+/** Defaults from config.h: min endstops at X_MIN or 0, max endstops at X_MAX
+ *  or nowhere. */
+static void sim_endstop_init(void) {
+  int i;
+
+  // Endstops not configured never trigger.
+  for (i = 0; i < 6; i++)
+    endstop[i].pos = (i & 1) ? INT_MAX : INT_MIN;
+
+  #ifdef X_MIN_PIN
+    endstop[0].used = true;
+    #ifdef X_MIN
+      endstop[0].pos = (int)(X_MIN * STEPS_PER_M_X / 1000.);
+    #else
+      endstop[0].pos = 0;
+    #endif
+    #ifdef X_INVERT_MIN
+      endstop[0].inverted = true;
+    #endif
+  #endif
+  #ifdef X_MAX_PIN
+    endstop[1].used = true;
+    #ifdef X_MAX
+      endstop[1].pos = (int)(X_MAX * STEPS_PER_M_X / 1000.);
+    #endif
+    #ifdef X_INVERT_MAX
+      endstop[1].inverted = true;
+    #endif
+  #endif
+  #ifdef Y_MIN_PIN
+    endstop[2].used = true;
+    #ifdef Y_MIN
+      endstop[2].pos = (int)(Y_MIN * STEPS_PER_M_Y / 1000.);
+    #else
+      endstop[2].pos = 0;
+    #endif
+    #ifdef Y_INVERT_MIN
+      endstop[2].inverted = true;
+    #endif
+  #endif
+  #ifdef Y_MAX_PIN
+    endstop[3].used = true;
+    #ifdef Y_MAX
+      endstop[3].pos = (int)(Y_MAX * STEPS_PER_M_Y / 1000.);
+    #endif
+    #ifdef Y_INVERT_MAX
+      endstop[3].inverted = true;
+    #endif
+  #endif
+  #ifdef Z_MIN_PIN
+    endstop[4].used = true;
+    #ifdef Z_MIN
+      endstop[4].pos = (int)(Z_MIN * STEPS_PER_M_Z / 1000.);
+    #else
+      endstop[4].pos = 0;
+    #endif
+    #ifdef Z_INVERT_MIN
+      endstop[4].inverted = true;
+    #endif
+  #endif
+  #ifdef Z_MAX_PIN
+    endstop[5].used = true;
+    #ifdef Z_MAX
+      endstop[5].pos = (int)(Z_MAX * STEPS_PER_M_Z / 1000.);
+    #endif
+    #ifdef Z_INVERT_MAX
+      endstop[5].inverted = true;
+    #endif
+  #endif
+}
+
+/** Parse --endstop=xmin:n[:b]. */
+static void sim_endstop_script(const char *arg) {
+  char axis, end[4];
+  int pos, bounce = 0, i;
+
+  if (sscanf(arg, "%c%3[a-z]:%d:%d", &axis, end, &pos, &bounce) < 3 ||
+      axis < 'x' || axis > 'z' ||
+      (strcmp(end, "min") && strcmp(end, "max")))
+    sim_error("Endstop expected as e.g. xmin:100 or zmax:-50:8");
+
+  i = (axis - 'x') * 2 + (end[1] == 'a');
+  if ( ! endstop[i].used)
+    sim_error("Endstop not configured in config.h");
+  endstop[i].pos = pos;
+  endstop[i].bounce = bounce;
+}
+
+/** Set the endstop pins of an axis after a step, queueing the pin change
+ *  interrupt if one changed. */
+static void sim_endstop_update(int axis) {
+  int i, d;
+  bool triggered;
+
+  for (i = axis * 2; i < axis * 2 + 2 && i < 6; i++) {
+    if ( ! endstop[i].used)
+      continue;
+
+    // Steps left until the trigger position, bouncing on odd steps.
+    d = (i & 1) ? endstop[i].pos - pos[axis] : pos[axis] - endstop[i].pos;
+    triggered = (d <= 0) || (d <= endstop[i].bounce && (d & 1));
+
+    if (state[endstop_pin[i]] != (triggered != endstop[i].inverted)) {
+      state[endstop_pin[i]] = (triggered != endstop[i].inverted);
+      record_pin(TRACE_PINS + endstop_pin[i], state[endstop_pin[i]],
+                 sim_runtime_ns());
+      if (endstop[i].pcint)
+        pcint_pending = true;
+    }
+  }
+}
+
+bool sim_pcint_enable(pin_t pin) {
+  int i;
+
+  for (i = 0; i < 6; i++)
+    if (endstop_pin[i] == pin)
+      endstop[i].pcint = true;
+  return true;
+}
+
+/** Called by the simulated timer interrupt, as steps are done there. */
+void sim_pcint_isr(void) {
+  if (pcint_pending) {
+    pcint_pending = false;
+    #ifdef ENDSTOP_INTERRUPT
+      PCINT0_vect();
+    #endif
+  }
+}
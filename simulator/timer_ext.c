@@ -155,7 +155,13 @@ static void timer1_isr(void) {
     then = now;
   #endif
 
-  if (tr & TIMER_OCR1A) TIMER1_COMPA_vect();
+  if (tr & TIMER_OCR1A) {
+    sim_step_isr_begin();
+    TIMER1_COMPA_vect();
+    sim_step_isr_end();
+    // Steps can move endstops, see --endstop.
+    sim_pcint_isr();
+  }
   if (tr & TIMER_OCR1B) TIMER1_COMPB_vect();
 
   sei();
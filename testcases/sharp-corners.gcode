@@ -0,0 +1,17 @@
+G21
+G90
+G92 E0
+(Extruding zigzag, about 150 degree direction changes)
+G1 X10 Y0 E0.5 F1000
+G1 X0 Y3 E1.0
+G1 X10 Y6 E1.5
+G1 X0 Y9 E2.0
+(Extruding move, then a travel turning by 125 degrees)
+G1 X10 Y9 E2.5
+G1 X4.26 Y17.19
+(The same corners, slow)
+G1 X10 Y20 E3.0 F50
+G1 X0 Y21 E3.5
+G1 X10 Y22 E4.0
+G1 X0 Y22.5
+M2